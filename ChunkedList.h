@@ -0,0 +1,316 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <new>
+#include <utility>
+
+// Sequence of values kept in a singly linked chain of arrays. The first
+// chunk holds one value, each following one twice as many as the previous,
+// up to about 1 KB per chunk. A key with a single value costs one small
+// allocation, and a key with thousands of values is walked array by array
+// instead of node by node. Chunks never stay empty, and removing from the
+// front only moves the start index of the first chunk.
+template <typename T>
+class ChunkedList
+{
+    static_assert(alignof(T) <= alignof(std::max_align_t), "ChunkedList doesn't support over-aligned types");
+
+private:
+    struct Chunk
+    {
+        Chunk* next;
+        uint32_t capacity;
+        uint32_t first;
+        uint32_t last;
+
+        T* items()
+        {
+            return reinterpret_cast<T*>(reinterpret_cast<char*>(this) + itemsOffset);
+        }
+        const T* items() const
+        {
+            return reinterpret_cast<const T*>(reinterpret_cast<const char*>(this) + itemsOffset);
+        }
+        bool isEmpty() const
+        {
+            return first == last;
+        }
+    };
+
+    static constexpr size_t itemsOffset = (sizeof(Chunk) + alignof(T) - 1) / alignof(T) * alignof(T);
+    static constexpr size_t maxChunkBytes = 1024;
+    static constexpr uint32_t maxChunkCapacity = sizeof(T) * 4 > maxChunkBytes ? 4 : maxChunkBytes / sizeof(T);
+
+    Chunk* firstChunk = nullptr;
+    Chunk* lastChunk = nullptr;
+    size_t numberOfItems = 0;
+    size_t numberOfChunks = 0;
+    size_t numberOfAllocatedBytes = 0;
+
+public:
+    class const_iterator
+    {
+    private:
+        friend class ChunkedList;
+
+        const Chunk* chunk = nullptr;
+        uint32_t index = 0;
+
+        const_iterator(const Chunk* chunk, uint32_t index) : chunk(chunk), index(index)
+        {
+        }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator()
+        {
+        }
+
+        const T& operator*() const
+        {
+            return chunk->items()[index];
+        }
+        const T* operator->() const
+        {
+            return chunk->items() + index;
+        }
+
+        const_iterator& operator++()
+        {
+            if (++index == chunk->last)
+            {
+                chunk = chunk->next;
+                index = chunk ? chunk->first : 0;
+            }
+            return *this;
+        }
+        const_iterator operator++(int)
+        {
+            const_iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const const_iterator& iterator) const
+        {
+            return chunk == iterator.chunk && index == iterator.index;
+        }
+        bool operator!=(const const_iterator& iterator) const
+        {
+            return !(*this == iterator);
+        }
+    };
+
+    ChunkedList()
+    {
+    }
+
+    ChunkedList(const ChunkedList& list)
+    {
+        for (const T& item : list)
+        {
+            pushBack(item);
+        }
+    }
+
+    ChunkedList(ChunkedList&& list) noexcept
+    {
+        swap(list);
+    }
+
+    ChunkedList& operator=(ChunkedList list) noexcept
+    {
+        swap(list);
+        return *this;
+    }
+
+    ~ChunkedList()
+    {
+        clear();
+    }
+
+    void swap(ChunkedList& list) noexcept
+    {
+        std::swap(firstChunk, list.firstChunk);
+        std::swap(lastChunk, list.lastChunk);
+        std::swap(numberOfItems, list.numberOfItems);
+        std::swap(numberOfChunks, list.numberOfChunks);
+        std::swap(numberOfAllocatedBytes, list.numberOfAllocatedBytes);
+    }
+
+    size_t size() const
+    {
+        return numberOfItems;
+    }
+
+    bool empty() const
+    {
+        return numberOfItems == 0;
+    }
+
+    // Each chunk is one heap allocation.
+    size_t chunkCount() const
+    {
+        return numberOfChunks;
+    }
+
+    // Bytes of all chunks: headers, values and unused capacity.
+    size_t allocatedBytes() const
+    {
+        return numberOfAllocatedBytes;
+    }
+
+    T& front()
+    {
+        return firstChunk->items()[firstChunk->first];
+    }
+    const T& front() const
+    {
+        return firstChunk->items()[firstChunk->first];
+    }
+
+    const_iterator begin() const
+    {
+        return firstChunk ? const_iterator(firstChunk, firstChunk->first) : end();
+    }
+    const_iterator end() const
+    {
+        return const_iterator();
+    }
+
+    void pushBack(const T& item)
+    {
+        if (lastChunk == nullptr || lastChunk->last == lastChunk->capacity)
+        {
+            appendChunk();
+        }
+        new (lastChunk->items() + lastChunk->last) T(item);
+        lastChunk->last++;
+        numberOfItems++;
+    }
+
+    // Removes up to count values from the front and returns how many it removed.
+    size_t popFront(size_t count)
+    {
+        size_t popped = 0;
+        while (popped < count && firstChunk)
+        {
+            firstChunk->items()[firstChunk->first].~T();
+            firstChunk->first++;
+            numberOfItems--;
+            popped++;
+
+            if (firstChunk->isEmpty())
+            {
+                removeChunk(firstChunk, nullptr);
+            }
+        }
+        return popped;
+    }
+
+    // Removes the first value the predicate accepts. Later values of the same
+    // chunk move one place forward.
+    template <typename TPredicate>
+    bool eraseFirstIf(TPredicate predicate)
+    {
+        Chunk* previousChunk = nullptr;
+        for (Chunk* chunk = firstChunk; chunk; previousChunk = chunk, chunk = chunk->next)
+        {
+            T* items = chunk->items();
+            for (uint32_t i = chunk->first; i < chunk->last; i++)
+            {
+                if (!predicate(static_cast<const T&>(items[i])))
+                    continue;
+
+                if (i == chunk->first)
+                {
+                    items[i].~T();
+                    chunk->first++;
+                }
+                else
+                {
+                    for (uint32_t j = i + 1; j < chunk->last; j++)
+                    {
+                        items[j - 1] = std::move(items[j]);
+                    }
+                    chunk->last--;
+                    items[chunk->last].~T();
+                }
+                numberOfItems--;
+
+                if (chunk->isEmpty())
+                {
+                    removeChunk(chunk, previousChunk);
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void clear()
+    {
+        while (firstChunk)
+        {
+            T* items = firstChunk->items();
+            for (uint32_t i = firstChunk->first; i < firstChunk->last; i++)
+            {
+                items[i].~T();
+            }
+            firstChunk->first = firstChunk->last;
+            removeChunk(firstChunk, nullptr);
+        }
+        numberOfItems = 0;
+    }
+
+private:
+    void appendChunk()
+    {
+        uint32_t capacity = 1;
+        if (lastChunk)
+        {
+            capacity = lastChunk->capacity * 2 < maxChunkCapacity ? lastChunk->capacity * 2 : maxChunkCapacity;
+        }
+
+        Chunk* chunk = static_cast<Chunk*>(::operator new(chunkBytes(capacity)));
+        chunk->next = nullptr;
+        chunk->capacity = capacity;
+        chunk->first = 0;
+        chunk->last = 0;
+
+        if (lastChunk)
+            lastChunk->next = chunk;
+        else
+            firstChunk = chunk;
+        lastChunk = chunk;
+        numberOfChunks++;
+        numberOfAllocatedBytes += chunkBytes(capacity);
+    }
+
+    void removeChunk(Chunk* chunk, Chunk* previousChunk)
+    {
+        if (previousChunk)
+            previousChunk->next = chunk->next;
+        else
+            firstChunk = chunk->next;
+
+        if (lastChunk == chunk)
+            lastChunk = previousChunk;
+
+        numberOfChunks--;
+        numberOfAllocatedBytes -= chunkBytes(chunk->capacity);
+        ::operator delete(chunk);
+    }
+
+    static size_t chunkBytes(uint32_t capacity)
+    {
+        return itemsOffset + capacity * sizeof(T);
+    }
+};
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+
+#include "RedBlackTree.h"
+#include "comparators/DefaultComparator.h"
+
+enum class EvictionPolicy
+{
+    LeastRecentlyUsed,
+    MinimalKey
+};
+
+// Cache index on top of RBTree: one value per key, each with an optional
+// deadline. Two more trees order the keys by deadline and by last use, so
+// expireUntil() pops expired entries from the front of the deadline index
+// and a bounded tree finds its victim at the front of an index instead of
+// scanning all keys. The deadline index is keyed by deadline and key, so
+// removing one key costs O(log n) however many keys share its deadline.
+// Entries stay visible to find() until expireUntil() removes them.
+template <typename TKey, typename TData, typename TClock = std::chrono::steady_clock>
+class ExpiringRBTree : public Tree<TKey, TData>
+{
+public:
+    using TimePoint = typename TClock::time_point;
+    using Duration = typename TClock::duration;
+
+private:
+    struct Entry
+    {
+        TData data = TData();
+        TimePoint deadline = TimePoint::max(); // never expires
+        uint64_t lastUse = 0;
+    };
+
+    struct Deadline
+    {
+        TimePoint time;
+        TKey key;
+    };
+
+    // Orders by time, then keys that share a time by the key comparator.
+    class DeadlineComparator : public ComparatorStrategy<Deadline>
+    {
+    private:
+        ComparatorStrategy<TKey>* keyComparator;
+
+    public:
+        explicit DeadlineComparator(ComparatorStrategy<TKey>* keyComparator) : keyComparator(keyComparator)
+        {
+        }
+
+        int compare(const Deadline& left, const Deadline& right) const override
+        {
+            if (left.time != right.time)
+                return left.time < right.time ? -1 : 1;
+            return keyComparator->compare(left.key, right.key);
+        }
+    };
+
+    DeadlineComparator deadlineComparator;
+    DefaultComparator<uint64_t> useComparator;
+
+    // With a LeastRecentlyUsed capacity find() counts as a use, so everything
+    // it touches then is mutable.
+    mutable RBTree<TKey, Entry> entries;
+    RBTree<Deadline, bool> deadlines; // only the keys matter; entries that never expire aren't indexed
+    mutable RBTree<uint64_t, TKey> recentUses; // only kept for a LeastRecentlyUsed capacity
+    mutable uint64_t numberOfUses = 0;
+    size_t numberOfEntries = 0;
+
+    Duration timeToLive = Duration::max();
+    size_t capacity = 0; // 0 means unbounded
+    EvictionPolicy evictionPolicy = EvictionPolicy::LeastRecentlyUsed;
+
+public:
+    ExpiringRBTree(ComparatorStrategy<TKey>* comparatorStrategy);
+    ExpiringRBTree(const ExpiringRBTree& tree) = delete;
+    ExpiringRBTree& operator=(const ExpiringRBTree& tree) = delete;
+
+    void setErrorHandler(void (*errorHandler)(const char* message));
+    void setTimeToLive(Duration timeToLive);
+    void setCapacity(size_t capacity, EvictionPolicy evictionPolicy);
+    size_t size() const;
+
+public:
+    bool add(const TKey& key, const TData& data) override;
+    bool add(const TKey& key, const TData& data, TimePoint deadline);
+    size_t pop(const TKey& key) override;
+    std::list<TData> find(const TKey& key) const override;
+    size_t expireUntil(TimePoint now);
+
+private:
+    bool tracksRecentUses() const;
+    void addToIndexes(const TKey& key, const Entry& entry);
+    void removeFromIndexes(const TKey& key, const Entry& entry);
+    void evictOverCapacity();
+};
+
+template <typename TKey, typename TData, typename TClock>
+ExpiringRBTree<TKey, TData, TClock>::ExpiringRBTree(ComparatorStrategy<TKey>* comparatorStrategy)
+    : deadlineComparator(comparatorStrategy),
+      entries(comparatorStrategy),
+      deadlines(&deadlineComparator),
+      recentUses(&useComparator)
+{
+}
+
+template <typename TKey, typename TData, typename TClock>
+void ExpiringRBTree<TKey, TData, TClock>::setErrorHandler(void (*errorHandler)(const char* message))
+{
+    entries.setErrorHandler(errorHandler);
+}
+
+// Lifetime of the entries added without a deadline. Entries added before
+// keep their deadlines.
+template <typename TKey, typename TData, typename TClock>
+void ExpiringRBTree<TKey, TData, TClock>::setTimeToLive(Duration timeToLive)
+{
+    this->timeToLive = timeToLive;
+}
+
+// Keeps at most capacity entries, evicting the least recently used or the
+// minimal key when an insert goes over it. 0 removes the bound. find() only
+// counts as a use while a LeastRecentlyUsed capacity is set, so switching to
+// one starts from the order of the last add() of each key, updated by the
+// finds of earlier LeastRecentlyUsed periods.
+template <typename TKey, typename TData, typename TClock>
+void ExpiringRBTree<TKey, TData, TClock>::setCapacity(size_t capacity, EvictionPolicy evictionPolicy)
+{
+    bool recentUsesWereTracked = tracksRecentUses();
+    this->capacity = capacity;
+    this->evictionPolicy = evictionPolicy;
+
+    if (!tracksRecentUses())
+    {
+        recentUses.clear();
+    }
+    else if (!recentUsesWereTracked)
+    {
+        for (auto entry = entries.begin(); entry != entries.end(); ++entry)
+        {
+            recentUses.add(entry.values().front().lastUse, entry.key());
+        }
+    }
+    evictOverCapacity();
+}
+
+template <typename TKey, typename TData, typename TClock>
+size_t ExpiringRBTree<TKey, TData, TClock>::size() const
+{
+    return numberOfEntries;
+}
+
+// Expires after the time to live, if one is set. Replaces the value and
+// deadline of an existing key.
+template <typename TKey, typename TData, typename TClock>
+bool ExpiringRBTree<TKey, TData, TClock>::add(const TKey& key, const TData& data)
+{
+    TimePoint deadline = TimePoint::max();
+    if (timeToLive != Duration::max())
+    {
+        deadline = TClock::now() + timeToLive;
+    }
+    return add(key, data, deadline);
+}
+
+template <typename TKey, typename TData, typename TClock>
+bool ExpiringRBTree<TKey, TData, TClock>::add(const TKey& key, const TData& data, TimePoint deadline)
+{
+    Entry entry;
+    entry.data = data;
+    entry.deadline = deadline;
+    entry.lastUse = ++numberOfUses;
+
+    Entry previousEntry;
+    bool stored = false;
+    bool inserted = entries.upsert(key, [&](Entry& storedEntry)
+    {
+        previousEntry = storedEntry;
+        storedEntry = entry;
+        stored = true;
+    });
+
+    if (!stored)
+    {
+        return false;
+    }
+
+    if (inserted)
+    {
+        numberOfEntries++;
+    }
+    else
+    {
+        removeFromIndexes(key, previousEntry);
+    }
+    addToIndexes(key, entry);
+    evictOverCapacity();
+    return inserted;
+}
+
+template <typename TKey, typename TData, typename TClock>
+size_t ExpiringRBTree<TKey, TData, TClock>::pop(const TKey& key)
+{
+    Entry entry;
+    bool popped = entries.popValueIf(key, [&entry](const Entry& storedEntry)
+    {
+        entry = storedEntry;
+        return true;
+    });
+
+    if (!popped)
+    {
+        return 0;
+    }
+
+    numberOfEntries--;
+    removeFromIndexes(key, entry);
+    return 1;
+}
+
+// With a LeastRecentlyUsed capacity a lookup is a use: find() then moves the
+// key to the back of the use order, and concurrent calls need a lock even
+// though find() is const. Otherwise it only reads.
+template <typename TKey, typename TData, typename TClock>
+std::list<TData> ExpiringRBTree<TKey, TData, TClock>::find(const TKey& key) const
+{
+    std::list<TData> values;
+    if (!tracksRecentUses())
+    {
+        auto entry = entries.findIterator(key);
+        if (entry != entries.end())
+        {
+            values.push_back(entry.values().front().data);
+        }
+        return values;
+    }
+
+    entries.update(key, [&](Entry& entry)
+    {
+        values.push_back(entry.data);
+
+        recentUses.pop(entry.lastUse);
+        entry.lastUse = ++numberOfUses;
+        recentUses.add(entry.lastUse, key);
+    });
+    return values;
+}
+
+// Removes every entry whose deadline is not after now, in deadline order.
+// Each eviction costs O(log n). Returns the number of entries removed.
+template <typename TKey, typename TData, typename TClock>
+size_t ExpiringRBTree<TKey, TData, TClock>::expireUntil(TimePoint now)
+{
+    size_t expiredEntries = 0;
+    for (auto oldest = deadlines.begin(); oldest != deadlines.end() && !(now < oldest.key().time); oldest = deadlines.begin())
+    {
+        Deadline deadline = oldest.key();
+        uint64_t lastUse = 0;
+        entries.popValueIf(deadline.key, [&lastUse](const Entry& entry)
+        {
+            lastUse = entry.lastUse;
+            return true;
+        });
+
+        if (tracksRecentUses())
+        {
+            recentUses.pop(lastUse);
+        }
+        deadlines.pop(deadline);
+        expiredEntries++;
+    }
+
+    numberOfEntries -= expiredEntries;
+    return expiredEntries;
+}
+
+template <typename TKey, typename TData, typename TClock>
+bool ExpiringRBTree<TKey, TData, TClock>::tracksRecentUses() const
+{
+    return capacity != 0 && evictionPolicy == EvictionPolicy::LeastRecentlyUsed;
+}
+
+template <typename TKey, typename TData, typename TClock>
+void ExpiringRBTree<TKey, TData, TClock>::addToIndexes(const TKey& key, const Entry& entry)
+{
+    if (entry.deadline != TimePoint::max())
+    {
+        deadlines.add(Deadline{entry.deadline, key}, true);
+    }
+    if (tracksRecentUses())
+    {
+        recentUses.add(entry.lastUse, key);
+    }
+}
+
+template <typename TKey, typename TData, typename TClock>
+void ExpiringRBTree<TKey, TData, TClock>::removeFromIndexes(const TKey& key, const Entry& entry)
+{
+    if (entry.deadline != TimePoint::max())
+    {
+        deadlines.pop(Deadline{entry.deadline, key});
+    }
+    if (tracksRecentUses())
+    {
+        recentUses.pop(entry.lastUse);
+    }
+}
+
+template <typename TKey, typename TData, typename TClock>
+void ExpiringRBTree<TKey, TData, TClock>::evictOverCapacity()
+{
+    while (capacity != 0 && numberOfEntries > capacity)
+    {
+        TKey victim = tracksRecentUses() ? recentUses.begin().values().front() : entries.begin().key();
+        pop(victim);
+    }
+}
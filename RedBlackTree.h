@@ -1,14 +1,74 @@
-#include <stack>
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
 #include <list>
+#include <new>
+#include <ostream>
+#include <stack>
+#include <utility>
+
+#include "ChunkedList.h"
+#include "comparators/ComparatorStrategy.h"
+
+// Define RBTREE_ENABLE_STATISTICS before including this header to count what
+// the tree does on its hot paths. Without it the counters don't exist and
+// the counting statements compile to nothing.
+struct RBTreeStatistics
+{
+    static const size_t depthHistogramSize = 64;
+
+    bool enabled = false;
+    uint64_t comparisons = 0;
+    uint64_t singleRotations = 0;
+    uint64_t doubleRotations = 0;
+    uint64_t recolorings = 0;
+    uint64_t nodeAllocations = 0; // nodes only, without their values
+    uint64_t nodeDeallocations = 0;
+    // Chunks of the value lists. A new key allocates its first chunk, and
+    // appending to a full chunk allocates the next one.
+    uint64_t chunkAllocations = 0;
+    uint64_t chunkDeallocations = 0;
+    uint64_t searches = 0;
+    // searchDepthHistogram[d] counts searches that visited d nodes; the last
+    // bucket also holds every deeper search.
+    uint64_t searchDepthHistogram[depthHistogramSize] = {};
+};
+
+// Bytes held by one RBTree, as counted by the tree itself while it changes.
+// The bookkeeping of the heap allocator isn't included.
+struct RBTreeMemoryUsage
+{
+    size_t nodeBytes = 0; // nodes of the stored keys, with their value list headers
+    size_t valueBytes = 0; // the stored values
+    size_t slackBytes = 0; // nodes kept by clear(true), chunk headers and unused chunk capacity
+    size_t userBytes = 0; // memory owned by the values, as reported by the memory usage hook
+    size_t totalBytes = 0;
+};
 
-#include "../comparators/ComparatorStrategy.h"
+#ifdef RBTREE_ENABLE_STATISTICS
+#define RBTREE_COUNT(counter, amount) (statisticsCounters.counter += (amount))
+#define RBTREE_COUNT_SEARCH(depth) countSearch(depth)
+#else
+#define RBTREE_COUNT(counter, amount) ((void)sizeof(amount))
+#define RBTREE_COUNT_SEARCH(depth) ((void)sizeof(depth))
+#endif
 
 template <typename TKey, typename TData>
 class Tree
 {
 public:
-    virtual void add(const TKey& key, const TData& data) = 0;
-    virtual void pop(const TKey& key) = 0;
+    // Returns true if the key was new, false if data joined an existing key.
+    // False never signals an error: a comparator is a precondition of the
+    // RBTree constructor, and nothing else makes an add fail.
+    virtual bool add(const TKey& key, const TData& data) = 0;
+    // Returns the number of values removed with the key, 0 if it was absent.
+    virtual size_t pop(const TKey& key) = 0;
+    // Returns an empty list if the key is absent.
     virtual std::list<TData> find(const TKey& key) const = 0;
     virtual ~Tree() = default;
 };
@@ -17,23 +77,17 @@ template <typename TKey, typename TData>
 class RBTree : public Tree<TKey, TData>
 {
 private:
-    struct KeyAndValue
-    {
-        TKey key;
-        TData data;
-    };
-
     class Node
     {
     public:
-        std::list<KeyAndValue> keysAndValues;
+        TKey key; // stored once per node so descent never leaves the node
+        ChunkedList<TData> values;
         Node *leftPtr, *rightPtr;
         bool isRed;
 
-        Node(const TKey& key, const TData& data)
+        Node(const TKey& key, const TData& data) : key(key)
         {
-            KeyAndValue newElement = {key, data};
-            keysAndValues.push_back(newElement);
+            values.pushBack(data);
 
             leftPtr = nullptr;
             rightPtr = nullptr;
@@ -59,14 +113,6 @@ private:
             return isRed == false;
         }
 
-        bool hasTheSameKeyWith(Node* node) const
-        {
-            const TKey& thisKey = keysAndValues.front().key;
-            const TKey& nodeKey = node->keysAndValues.front().key;
-
-            return thisKey == nodeKey;
-        }
-
         Node* returnAnotherChild(Node* child) const
         {
             if (leftPtr == child)
@@ -104,9 +150,9 @@ private:
             return nullptr;
         }
 
-        Node(const Node& node)
+        Node(const Node& node) : key(node.key)
         {
-            this->keysAndValues = node.keysAndValues;
+            this->values = node.values;
 
             this->leftPtr = node.leftPtr;
             this->rightPtr = node.rightPtr;
@@ -119,7 +165,7 @@ private:
             Node* leftChild = leftPtr;
             Node* rightChild = rightPtr;
 
-            Node *leftRedNephew, *rightRedNephew;
+            Node *leftRedNephew = nullptr, *rightRedNephew = nullptr;
             if (leftChild)
                 leftRedNephew = leftChild->returnRedChildOrNullptr();
             if (rightChild)
@@ -130,24 +176,24 @@ private:
             return false;
         }
 
-        Node* returnSon(Node* grandson, ComparatorStrategy<TKey>* comparatorStrategy) const 
+        Node* returnSon(Node* grandson, const RBTree* tree) const 
         {
-            const TKey& key = keysAndValues.front().key;
-            const TKey& grandsonKey = grandson->keysAndValues.front().key;
+            const TKey& key = this->key;
+            const TKey& grandsonKey = grandson->key;
 
-            int compareGrandfatherAndGrandson = comparatorStrategy->compare(key, grandsonKey);
+            int compareGrandfatherAndGrandson = tree->compareKeys(key, grandsonKey);
             if (compareGrandfatherAndGrandson < 0)
                 return rightPtr;
             else
                 return leftPtr;
         }
 
-        Node* returnGrandsonByZigzag(Node* greatGrandfather, ComparatorStrategy<TKey>* comparatorStrategy) const
+        Node* returnGrandsonByZigzag(Node* greatGrandfather, const RBTree* tree) const
         {
-            const TKey& key = this->keysAndValues.front().key;
-            const TKey& greatGrandfatherKey = greatGrandfather->keysAndValues.front().key;
+            const TKey& key = this->key;
+            const TKey& greatGrandfatherKey = greatGrandfather->key;
 
-            int compareGreatGrandfatherAndGrandfather = comparatorStrategy->compare(greatGrandfatherKey, key);
+            int compareGreatGrandfatherAndGrandfather = tree->compareKeys(greatGrandfatherKey, key);
             Node *grandfather, *father, *grandson;
 
             if (compareGreatGrandfatherAndGrandfather > 0)
@@ -165,12 +211,12 @@ private:
             return grandson;
         }
 
-        Node* returnSonByZigzag(Node* grandfather, ComparatorStrategy<TKey>* comparatorStrategy) const
+        Node* returnSonByZigzag(Node* grandfather, const RBTree* tree) const
         {
-            const TKey& key = keysAndValues.front().key;
-            const TKey& grandfatherKey = grandfather->keysAndValues.front().key;
+            const TKey& key = this->key;
+            const TKey& grandfatherKey = grandfather->key;
 
-            int compareGrandfatherAndFather =  comparatorStrategy->compare(grandfatherKey, key); 
+            int compareGrandfatherAndFather = tree->compareKeys(grandfatherKey, key); 
             if (compareGrandfatherAndFather > 0)
             {
                 return rightPtr;
@@ -183,25 +229,143 @@ private:
 
         std::list<TData> returnData() const
         {
-            std::list<TData> values;
-            for (const KeyAndValue& keyAndValue : keysAndValues)
-            {
-                values.push_back(keyAndValue.data);
-            }
-            return values;
+            return std::list<TData>(values.begin(), values.end());
         }
 
-        void log(void (*function)(const TKey&, const TData&)) const
+        void log(std::ostream& out, void (*function)(const TKey&, const TData&)) const
         {
-            this->nodeIsRed() ? std::cout << "Red " : std::cout << "Black ";
+            this->nodeIsRed() ? out << "Red " : out << "Black ";
 
-            for (const KeyAndValue& keyAndValue : keysAndValues)
+            for (const TData& data : values)
             {
-                std::cout << "[";
-                function(keyAndValue.key, keyAndValue.data);
-                std::cout << "] ";
+                out << "[";
+                function(key, data);
+                out << "] ";
             }
-            std::cout << std::endl;
+            out << '\n';
+        }
+    };
+
+    // Path of nodes from head down to some node. A tree of n nodes is at most
+    // 2 * log2(n + 1) high and numberOfNodes is 32-bit, so a fixed array
+    // always fits and no search has to allocate.
+    class NodeStack
+    {
+    private:
+        static const size_t capacity = 96;
+        Node* nodes[capacity];
+        size_t numberOfNodes = 0;
+
+    public:
+        NodeStack()
+        {
+        }
+
+        NodeStack(const NodeStack& nodeStack) : numberOfNodes(nodeStack.numberOfNodes)
+        {
+            std::copy(nodeStack.nodes, nodeStack.nodes + numberOfNodes, nodes);
+        }
+
+        NodeStack& operator=(const NodeStack& nodeStack)
+        {
+            numberOfNodes = nodeStack.numberOfNodes;
+            std::copy(nodeStack.nodes, nodeStack.nodes + numberOfNodes, nodes);
+            return *this;
+        }
+
+        void push(Node* node)
+        {
+            nodes[numberOfNodes++] = node;
+        }
+        void pop()
+        {
+            numberOfNodes--;
+        }
+        Node* top() const
+        {
+            return nodes[numberOfNodes - 1];
+        }
+        Node* at(size_t index) const
+        {
+            return nodes[index];
+        }
+        // Cuts the path back to its first size nodes. pop() leaves the nodes
+        // in place, so a larger size walks a popped path back down, as long
+        // as the tree along it didn't change shape.
+        void restore(size_t size)
+        {
+            numberOfNodes = size;
+        }
+        bool empty() const
+        {
+            return numberOfNodes == 0;
+        }
+        size_t size() const
+        {
+            return numberOfNodes;
+        }
+        void clear()
+        {
+            numberOfNodes = 0;
+        }
+    };
+
+public:
+    // Walks the keys in ascending order. An iterator remembers the path from
+    // the root, so ++ and -- need no comparisons. Any change to the tree
+    // invalidates all iterators except the one returned by insert.
+    class Iterator
+    {
+    private:
+        friend class RBTree;
+
+        const RBTree* tree = nullptr;
+        NodeStack path;
+
+        Iterator(const RBTree* tree, const NodeStack& path) : tree(tree), path(path)
+        {
+        }
+
+    public:
+        Iterator()
+        {
+        }
+
+        const TKey& key() const
+        {
+            return path.top()->key;
+        }
+
+        const ChunkedList<TData>& values() const
+        {
+            return path.top()->values;
+        }
+
+        Iterator& operator++()
+        {
+            moveToNext(path);
+            return *this;
+        }
+
+        Iterator& operator--()
+        {
+            if (path.empty())
+                tree->pushRightmostPath(path, tree->head);
+            else
+                moveToPrevious(path);
+            return *this;
+        }
+
+        bool operator==(const Iterator& iterator) const
+        {
+            Node* node = path.empty() ? nullptr : path.top();
+            Node* iteratorNode = iterator.path.empty() ? nullptr : iterator.path.top();
+            return tree == iterator.tree && node == iteratorNode;
+        }
+
+        bool operator!=(const Iterator& iterator) const
+        {
+            return !(*this == iterator);
         }
     };
 
@@ -210,100 +374,366 @@ private:
     ComparatorStrategy<TKey>* comparatorStrategy = nullptr;
     unsigned int numberOfNodes;
     void (*function)(const TKey&, const TData&) = nullptr; // TODO: delete 
+    void (*errorHandler)(const char* message) = nullptr;
+
+    // Memory of nodes released by clear(true), reused by later inserts.
+    struct FreeNode
+    {
+        FreeNode* next;
+    };
+    FreeNode* freeNodes = nullptr;
+    size_t numberOfFreeNodes = 0;
+
+    // Kept up to date by every path that stores or removes values.
+    size_t numberOfValues = 0;
+    size_t valueStorageBytes = 0; // allocated by the value lists
+    size_t userBytes = 0;
+    size_t (*memoryUsageHook)(const TData& data) = nullptr;
+#ifdef RBTREE_ENABLE_STATISTICS
+    mutable RBTreeStatistics statisticsCounters;
+#endif
 
 public:
     RBTree(ComparatorStrategy<TKey>* comparatorStrategy);
 
 public:
-    void add(const TKey& key, const TData& data) override;
+    void setErrorHandler(void (*errorHandler)(const char* message));
+private:
+    void reportError(const char* message) const;
+
+public:
+    bool add(const TKey& key, const TData& data) override;
+    bool insertOrAssign(const TKey& key, const TData& data);
+    template <typename TFunction>
+    bool upsert(const TKey& key, TFunction function);
+    template <typename TFunction>
+    bool update(const TKey& key, TFunction function);
+    Iterator insert(const Iterator& hint, const TKey& key, const TData& data);
 private:
-    void tryAdd(const TKey& key, const TData& data);
-    void initStackOfPreviousNodesInInsert(std::stack<Node*>& nodeStack, const TKey& keyToFind) const;
-    void linkOrUnionChildWithFatherInInsert(Node* child, Node* father);
+    bool tryAdd(const TKey& key, const TData& data);
+    int initStackOfPreviousNodesInInsert(NodeStack& nodeStack, const TKey& keyToFind) const;
+    bool moveHintToInsertPosition(NodeStack& nodeStack, const TKey& key, int& compareResult) const;
+    Node* linkOrUnionChildWithFatherInInsert(const TKey& key, const TData& data, Node* father, int compareFatherAndChild);
+    bool rebalanceAfterInsert(Node* child, Node* father, NodeStack& nodeStack);
 
 public:
-    void pop(const TKey& key) override;
+    size_t pop(const TKey& key) override;
+    size_t popFirstValues(const TKey& key, size_t count);
+    bool popValue(const TKey& key, const TData& data);
+    template <typename TPredicate>
+    bool popValueIf(const TKey& key, TPredicate predicate);
 private:
-    void tryPop(const TKey& key);
-    void initStackOfPreviousNodesInDeletionOrThrowException(std::stack<Node*>& nodeStack, const TKey& keyToFind) const;
+    template <typename TEraser>
+    size_t tryPop(const TKey& key, TEraser eraseValues);
+    void deleteNodeOnTopOfStack(NodeStack& nodeStack);
+    bool initStackOfPreviousNodesInDeletion(NodeStack& nodeStack, const TKey& keyToFind) const;
     void deleteNode(Node* toDelete, Node* father);
     void deleteBranch(Node* toDelete, Node* father);
     void deleteRedLeaf(Node* toDelete, Node* father);
-    void findMaxNodeInLeftBranchAndUpdateStack(std::stack<Node*>& nodeStack) const;
-    void deleteLeafOrBranch(std::stack<Node*>& nodeStack);
+    void findMaxNodeInLeftBranchAndUpdateStack(NodeStack& nodeStack) const;
+    void deleteLeafOrBranch(NodeStack& nodeStack);
     void deleteBranchOrRedLeaf(Node* child, Node* father);
 
 public:
     std::list<TData> find(const TKey& key) const override;
+    std::list<TData> findPage(const TKey& key, size_t offset, size_t limit) const;
+    size_t count(const TKey& key) const;
+    Iterator findIterator(const TKey& key) const;
+    Iterator lowerBound(const TKey& key) const;
+    Iterator begin() const;
+    Iterator end() const;
+private:
+    Node* findNode(const TKey& key) const;
+    static void moveToNext(NodeStack& nodeStack);
+    static void moveToPrevious(NodeStack& nodeStack);
+    void pushLeftmostPath(NodeStack& nodeStack, Node* startNode) const;
+    void pushRightmostPath(NodeStack& nodeStack, Node* startNode) const;
+    void descendToKey(NodeStack& nodeStack, const TKey& key) const;
 
 public:
-    void print(void (*function)(const TKey&, const TData&));
+    void print(std::ostream& out, void (*function)(const TKey&, const TData&)) const;
 private:
-    void doPrint(void (*function)(const TKey&, const TData&), Node* startNode) const;
+    void doPrint(std::ostream& out, void (*function)(const TKey&, const TData&), Node* startNode) const;
 
 private:
-    void hangNodesAfterTurn(Node* nodeToHang, std::stack<Node*>& nodeStack);
+    void hangNodesAfterTurn(Node* nodeToHang, NodeStack& nodeStack);
     void hangNodesAfterTurn(Node* nodeToHang, Node* previousNode) const;
     bool needToMakeSingleTurn(Node* grandfather, Node* grandson) const;
     void makeSingleTurn(Node* grandfather, Node* grandson) const;
     void makeDoubleTurn(Node* grandfather, Node* grandson) const;
-    void throwExceptionIfThereIsNoCompare() const;
-    Node* pullOutNodeFromStack(std::stack<Node*>& nodeStack) const;
+    bool comparatorIsMissing() const;
+    Node* pullOutNodeFromStack(NodeStack& nodeStack) const;
     Node* returnFather(Node* grandfather, Node* grandson) const;
     bool isEmpty() const;
     void swapNodes(Node* first, Node* second) const;
 
 public:
+    RBTreeStatistics getStatistics() const;
+    void resetStatistics();
+private:
+    int compareKeys(const TKey& first, const TKey& second) const;
+    void repaintRed(Node* node) const;
+    void repaintBlack(Node* node) const;
+    void* allocateNode();
+    Node* createNode(const TKey& key, const TData& data);
+    Node* createNodeCopy(const Node* node);
+    void destroyNode(Node* node);
+    void recycleNode(Node* node);
+    void releaseFreeNodes();
+    void countSearch(size_t depth) const;
+
+public:
+    size_t size() const;
+    size_t keyCount() const;
+    size_t valueCount() const;
+    RBTreeMemoryUsage memoryUsage() const;
+    void setMemoryUsageHook(size_t (*memoryUsageHook)(const TData& data));
+    bool validate() const;
+private:
+    void appendValue(Node* node, const TData& data);
+    template <typename TFunction>
+    void modifyFirstValue(Node* node, TFunction function);
+    void countValuesOf(const Node* node);
+    void uncountValuesOf(const Node* node);
+    size_t userBytesOf(const TData& data) const;
+    size_t userBytesOf(const ChunkedList<TData>& values, size_t count) const;
+
+public:
+    RBTree(const RBTree& tree);
+    RBTree(RBTree&& tree) noexcept;
+    RBTree& operator=(RBTree tree) noexcept;
+    void swap(RBTree& tree) noexcept;
+private:
+    void copyNodesOf(const RBTree& tree);
+
+public:
+    void clear(bool keepNodesForReuse = false);
     ~RBTree();
 private:
-    void makeRecursiveRemovalOfNodeForDestructor(Node* ptr) const;
+    void removeAllNodes(bool keepNodesForReuse);
 };
 
+// comparatorStrategy must not be null. Debug builds assert it here, so
+// add(), insertOrAssign() and upsert() can use false for an existing key
+// only. In release builds a missing comparator is still reported through
+// the error handler, but the return values can't tell it apart.
 template <typename TKey, typename TData>
 RBTree<TKey, TData>::RBTree(ComparatorStrategy<TKey>* comparatorStrategy)
 {
+    assert(comparatorStrategy != nullptr && "RBTree needs a comparator");
     head = nullptr;
     numberOfNodes = 0;
     this->comparatorStrategy = comparatorStrategy;
+    resetStatistics();
 }
 
 
 template <typename TKey, typename TData>
-void RBTree<TKey, TData>::add(const TKey& key, const TData& data)
+void RBTree<TKey, TData>::setErrorHandler(void (*errorHandler)(const char* message))
 {
-    try
+    this->errorHandler = errorHandler;
+}
+
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::reportError(const char* message) const
+{
+    if (errorHandler)
+        errorHandler(message);
+}
+
+template <typename TKey, typename TData>
+bool RBTree<TKey, TData>::add(const TKey& key, const TData& data)
+{
+    return tryAdd(key, data);
+}
+
+template <typename TKey, typename TData>
+bool RBTree<TKey, TData>::tryAdd(const TKey& key, const TData& data)
+{
+    if (isEmpty())
     {
-        tryAdd(key, data);
+        head = createNode(key, data);
+        head->makeBlack();
+        numberOfNodes = 1;
+        return true;
     }
-    catch (const std::exception& e)
+
+    if (comparatorIsMissing())
+    {
+        return false;
+    }
+
+    NodeStack nodeStack;
+    int compareResult = initStackOfPreviousNodesInInsert(nodeStack, key);
+    RBTREE_COUNT_SEARCH(nodeStack.size());
+
+    Node* father = pullOutNodeFromStack(nodeStack);
+
+    Node* child = linkOrUnionChildWithFatherInInsert(key, data, father, compareResult);
+    if (child == nullptr)
     {
-        std::cerr << e.what() << '\n';
+        return false;
     }
+    rebalanceAfterInsert(child, father, nodeStack);
+    return true;
 }
 
+// Replaces all values of an existing key with data.
 template <typename TKey, typename TData>
-void RBTree<TKey, TData>::tryAdd(const TKey& key, const TData& data)
+bool RBTree<TKey, TData>::insertOrAssign(const TKey& key, const TData& data)
 {
     if (isEmpty())
     {
-        head = new Node(key, data);
-        head->makeBlack();
-        numberOfNodes = 1;
-        return;
+        return tryAdd(key, data);
+    }
+
+    if (comparatorIsMissing())
+    {
+        return false;
+    }
+
+    NodeStack nodeStack;
+    int compareResult = initStackOfPreviousNodesInInsert(nodeStack, key);
+    RBTREE_COUNT_SEARCH(nodeStack.size());
+
+    if (compareResult == 0)
+    {
+        // The last value is assigned in place, so its chunk is kept and an
+        // existing key costs no allocation.
+        Node* node = nodeStack.top();
+        RBTREE_COUNT(chunkDeallocations, node->values.chunkCount() - 1);
+        uncountValuesOf(node);
+        node->values.popFront(node->values.size() - 1);
+        node->values.front() = data;
+        countValuesOf(node);
+        return false;
+    }
+
+    Node* father = pullOutNodeFromStack(nodeStack);
+    Node* child = linkOrUnionChildWithFatherInInsert(key, data, father, compareResult);
+    rebalanceAfterInsert(child, father, nodeStack);
+    return true;
+}
+
+// Calls function on the first value of key, inserting a default-constructed
+// value first if the key is absent. Returns true if the key was inserted.
+template <typename TKey, typename TData>
+template <typename TFunction>
+bool RBTree<TKey, TData>::upsert(const TKey& key, TFunction function)
+{
+    if (isEmpty())
+    {
+        tryAdd(key, TData());
+        modifyFirstValue(head, function);
+        return true;
+    }
+
+    if (comparatorIsMissing())
+    {
+        return false;
     }
 
-    throwExceptionIfThereIsNoCompare();
+    NodeStack nodeStack;
+    int compareResult = initStackOfPreviousNodesInInsert(nodeStack, key);
+    RBTREE_COUNT_SEARCH(nodeStack.size());
 
-    std::stack<Node*> nodeStack;
-    initStackOfPreviousNodesInInsert(nodeStack, key);
+    if (compareResult == 0)
+    {
+        modifyFirstValue(nodeStack.top(), function);
+        return false;
+    }
 
-    Node* child = new Node(key, data);
     Node* father = pullOutNodeFromStack(nodeStack);
+    Node* child = linkOrUnionChildWithFatherInInsert(key, TData(), father, compareResult);
+    modifyFirstValue(child, function);
+    rebalanceAfterInsert(child, father, nodeStack);
+    return true;
+}
 
-    linkOrUnionChildWithFatherInInsert(child, father);
-    if (father->nodeIsBlack() || father->hasTheSameKeyWith(child))
+// Calls function on the first value of key. Returns false, without
+// inserting anything, if the key is absent.
+template <typename TKey, typename TData>
+template <typename TFunction>
+bool RBTree<TKey, TData>::update(const TKey& key, TFunction function)
+{
+    if (comparatorIsMissing())
     {
-        return;
+        return false;
+    }
+
+    Node* node = findNode(key);
+    if (node == nullptr)
+    {
+        return false;
+    }
+    modifyFirstValue(node, function);
+    return true;
+}
+
+// Inserts next to hint without descending from the root when key belongs
+// right before or right after hint, e.g. when hint is the previously
+// inserted key of an ascending sequence. Any other hint costs a normal
+// insert. Returns an iterator to key.
+template <typename TKey, typename TData>
+typename RBTree<TKey, TData>::Iterator RBTree<TKey, TData>::insert(const Iterator& hint, const TKey& key, const TData& data)
+{
+    if (isEmpty())
+    {
+        tryAdd(key, data);
+        return begin();
+    }
+
+    if (comparatorIsMissing())
+    {
+        return end();
+    }
+
+    // The hint's path is copied once, into the returned iterator, and
+    // turned into the path to key in place.
+    Iterator position = hint;
+    position.tree = this;
+    NodeStack& nodeStack = position.path;
+    int compareResult;
+    if (!moveHintToInsertPosition(nodeStack, key, compareResult))
+    {
+        nodeStack.clear();
+        compareResult = initStackOfPreviousNodesInInsert(nodeStack, key);
+        RBTREE_COUNT_SEARCH(nodeStack.size());
+    }
+
+    if (compareResult == 0)
+    {
+        appendValue(nodeStack.top(), data);
+        return position;
+    }
+
+    size_t fatherDepth = nodeStack.size();
+    Node* father = pullOutNodeFromStack(nodeStack);
+    Node* child = linkOrUnionChildWithFatherInInsert(key, data, father, compareResult);
+
+    // A rotation happens where the rebalancing stops, so the path above it
+    // is still valid and only the levels the rebalancing climbed are walked
+    // again. Without one only colours changed and the popped path still
+    // leads to father.
+    if (rebalanceAfterInsert(child, father, nodeStack))
+    {
+        descendToKey(nodeStack, key);
+        return position;
+    }
+    nodeStack.restore(fatherDepth);
+    nodeStack.push(child);
+    return position;
+}
+
+// Restores the red-black properties after child was linked to father.
+// nodeStack holds the path from head to father's father. Returns true if a
+// rotation changed the shape of the tree.
+template <typename TKey, typename TData>
+bool RBTree<TKey, TData>::rebalanceAfterInsert(Node* child, Node* father, NodeStack& nodeStack)
+{
+    if (father->nodeIsBlack())
+    {
+        return false;
     }
     
     while (father != nullptr && father->nodeIsRed())
@@ -318,23 +748,23 @@ void RBTree<TKey, TData>::tryAdd(const TKey& key, const TData& data)
                 makeSingleTurn(grandfather, child);
                 hangNodesAfterTurn(father, nodeStack);
 
-                father->makeBlack();
+                repaintBlack(father);
             }
             else
             {
                 makeDoubleTurn(grandfather, child);
                 hangNodesAfterTurn(child, nodeStack);
 
-                child->makeBlack();
+                repaintBlack(child);
             }
-            grandfather->makeRed();
-            return;
+            repaintRed(grandfather);
+            return true;
         }
         else // make repaint
         {
-            father->makeBlack();
-            uncle->makeBlack();
-            grandfather->makeRed();
+            repaintBlack(father);
+            repaintBlack(uncle);
+            repaintRed(grandfather);
 
             child = grandfather;
         }
@@ -342,21 +772,25 @@ void RBTree<TKey, TData>::tryAdd(const TKey& key, const TData& data)
     }
 
     if (head->nodeIsRed())
-        head->makeBlack();
+        repaintBlack(head);
+    return false;
 }
 
+// Returns the result of comparing the last node on the stack with the key:
+// 0 if it holds the key, otherwise the side the key would hang on.
 template <typename TKey, typename TData>
-void RBTree<TKey, TData>::initStackOfPreviousNodesInInsert(
-        std::stack<Node*>& nodeStack,
+int RBTree<TKey, TData>::initStackOfPreviousNodesInInsert(
+        NodeStack& nodeStack,
         const TKey& keyToFind) const {
             
     Node* nodePtr = head;
+    int compareResult = 0;
     while (nodePtr)
     {
         nodeStack.push(nodePtr);
         
-        const TKey& key = nodePtr->keysAndValues.front().key;
-        int compareResult = comparatorStrategy->compare(key, keyToFind);
+        const TKey& key = nodePtr->key;
+        compareResult = compareKeys(key, keyToFind);
 
         if (compareResult < 0)
         {
@@ -368,63 +802,229 @@ void RBTree<TKey, TData>::initStackOfPreviousNodesInInsert(
         }
         else
         {
-            return;
+            break;
         }
     }
+    return compareResult;
 }
 
+// Turns the path to a hint into what initStackOfPreviousNodesInInsert would
+// have built for key, if key belongs between the hint and one of its
+// neighbours. An empty path stands for end(). Returns false, with the path
+// left as it was, otherwise. The neighbours are found through the pointers
+// and the stack, so the path is never copied.
 template <typename TKey, typename TData>
-void RBTree<TKey, TData>::linkOrUnionChildWithFatherInInsert(Node* child, Node* father)
+bool RBTree<TKey, TData>::moveHintToInsertPosition(NodeStack& nodeStack, const TKey& key, int& compareResult) const
 {
-    const TKey& fatherKey = father->keysAndValues.front().key;
-    const TKey& childKey = child->keysAndValues.front().key;
+    if (nodeStack.empty())
+    {
+        pushRightmostPath(nodeStack, head);
+    }
+
+    Node* hint = nodeStack.top();
+    int compareHintAndKey = compareKeys(hint->key, key);
+    if (compareHintAndKey == 0)
+    {
+        compareResult = 0;
+        return true;
+    }
+
+    if (compareHintAndKey < 0)
+    {
+        if (hint->rightPtr != nullptr)
+        {
+            Node* next = hint->rightPtr;
+            while (next->leftPtr)
+            {
+                next = next->leftPtr;
+            }
+            int compareNextAndKey = compareKeys(next->key, key);
+            if (compareNextAndKey < 0)
+                return false;
 
-    int compareFatherAndChild = comparatorStrategy->compare(fatherKey, childKey);
-    if (compareFatherAndChild < 0)
+            pushLeftmostPath(nodeStack, hint->rightPtr);
+            compareResult = compareNextAndKey == 0 ? 0 : 1;
+            return true;
+        }
+
+        // The next key is the nearest ancestor whose left subtree holds hint.
+        size_t depth = nodeStack.size() - 1;
+        while (depth != 0 && nodeStack.at(depth - 1)->rightPtr == nodeStack.at(depth))
+        {
+            depth--;
+        }
+        if (depth != 0)
+        {
+            int compareNextAndKey = compareKeys(nodeStack.at(depth - 1)->key, key);
+            if (compareNextAndKey < 0)
+                return false;
+            if (compareNextAndKey == 0)
+            {
+                nodeStack.restore(depth);
+                compareResult = 0;
+                return true;
+            }
+        }
+        compareResult = -1;
+        return true;
+    }
+
+    if (hint->leftPtr != nullptr)
+    {
+        Node* previous = hint->leftPtr;
+        while (previous->rightPtr)
+        {
+            previous = previous->rightPtr;
+        }
+        int comparePreviousAndKey = compareKeys(previous->key, key);
+        if (comparePreviousAndKey > 0)
+            return false;
+
+        pushRightmostPath(nodeStack, hint->leftPtr);
+        compareResult = comparePreviousAndKey == 0 ? 0 : -1;
+        return true;
+    }
+
+    // The previous key is the nearest ancestor whose right subtree holds hint.
+    size_t depth = nodeStack.size() - 1;
+    while (depth != 0 && nodeStack.at(depth - 1)->leftPtr == nodeStack.at(depth))
     {
-        father->rightPtr = child;
-        numberOfNodes++;
+        depth--;
     }
-    else if (compareFatherAndChild > 0)
+    if (depth != 0)
     {
-        father->leftPtr = child;
-        numberOfNodes++;
+        int comparePreviousAndKey = compareKeys(nodeStack.at(depth - 1)->key, key);
+        if (comparePreviousAndKey > 0)
+            return false;
+        if (comparePreviousAndKey == 0)
+        {
+            nodeStack.restore(depth);
+            compareResult = 0;
+            return true;
+        }
     }
-    else
+    compareResult = 1;
+    return true;
+}
+
+template <typename TKey, typename TData>
+typename RBTree<TKey, TData>::Node* RBTree<TKey, TData>::linkOrUnionChildWithFatherInInsert(
+        const TKey& key,
+        const TData& data,
+        Node* father,
+        int compareFatherAndChild) {
+
+    if (compareFatherAndChild == 0)
     {
-        KeyAndValue newElement = {child->keysAndValues.front().key, child->keysAndValues.front().data};
-        father->keysAndValues.push_back(newElement);
+        appendValue(father, data);
+        return nullptr;
     }
+
+    Node* child = createNode(key, data);
+    compareFatherAndChild < 0 ? father->rightPtr = child : father->leftPtr = child;
+    numberOfNodes++;
+    return child;
 }
 
 
 template <typename TKey, typename TData>
-void RBTree<TKey,TData>::pop(const TKey& key)
+size_t RBTree<TKey,TData>::pop(const TKey& key)
 {
-    try
+    return tryPop(key, [this](ChunkedList<TData>& values)
     {
-        tryPop(key);
-    }
-    catch(const std::exception& e)
+        size_t poppedValues = values.size();
+        userBytes -= userBytesOf(values, poppedValues);
+        values.clear();
+        return poppedValues;
+    });
+}
+
+// Removes the oldest count values of the key, and the key itself once it has
+// no values left. Returns the number of values removed.
+template <typename TKey, typename TData>
+size_t RBTree<TKey,TData>::popFirstValues(const TKey& key, size_t count)
+{
+    return tryPop(key, [this, count](ChunkedList<TData>& values)
     {
-        std::cerr << e.what() << '\n';
-    }
-    
+        userBytes -= userBytesOf(values, count);
+        return values.popFront(count);
+    });
+}
+
+// Removes the first value of the key equal to data. The key goes away with
+// its last value.
+template <typename TKey, typename TData>
+bool RBTree<TKey,TData>::popValue(const TKey& key, const TData& data)
+{
+    return popValueIf(key, [&data](const TData& value)
+    {
+        return value == data;
+    });
+}
+
+// Removes the first value of the key the predicate accepts. The key goes
+// away with its last value.
+template <typename TKey, typename TData>
+template <typename TPredicate>
+bool RBTree<TKey,TData>::popValueIf(const TKey& key, TPredicate predicate)
+{
+    return tryPop(key, [this, &predicate](ChunkedList<TData>& values)
+    {
+        bool erased = values.eraseFirstIf([this, &predicate](const TData& value)
+        {
+            if (!predicate(value))
+                return false;
+            userBytes -= userBytesOf(value);
+            return true;
+        });
+        return erased ? 1 : 0;
+    }) != 0;
 }
 
+// Finds the key, lets eraseValues remove some of its values and deletes the
+// node if none are left, reusing the path of the search. eraseValues returns
+// the number of values it removed and takes their hook bytes off userBytes.
 template <typename TKey, typename TData>
-void RBTree<TKey,TData>::tryPop(const TKey& key)
+template <typename TEraser>
+size_t RBTree<TKey,TData>::tryPop(const TKey& key, TEraser eraseValues)
 {
     if (isEmpty())
     {
-        throw std::invalid_argument("Can't do pop. Tree is empty!");
+        reportError("Can't do pop. Tree is empty!");
+        return 0;
+    }
+
+    if (comparatorIsMissing())
+    {
+        return 0;
     }
 
-    throwExceptionIfThereIsNoCompare();
+    NodeStack nodeStack;
+    bool found = initStackOfPreviousNodesInDeletion(nodeStack, key);
+    RBTREE_COUNT_SEARCH(nodeStack.size());
+    if (!found)
+    {
+        reportError("No element in tree!");
+        return 0;
+    }
 
-    std::stack<Node*> nodeStack;
-    initStackOfPreviousNodesInDeletionOrThrowException(nodeStack, key);
+    Node* child = nodeStack.top();
+    size_t bytesBefore = child->values.allocatedBytes();
+    size_t chunksBefore = child->values.chunkCount();
+    size_t poppedValues = eraseValues(child->values);
+    RBTREE_COUNT(chunkDeallocations, chunksBefore - child->values.chunkCount());
+    numberOfValues -= poppedValues;
+    valueStorageBytes -= bytesBefore - child->values.allocatedBytes();
+    if (child->values.empty())
+    {
+        deleteNodeOnTopOfStack(nodeStack);
+    }
+    return poppedValues;
+}
 
+template <typename TKey, typename TData>
+void RBTree<TKey,TData>::deleteNodeOnTopOfStack(NodeStack& nodeStack)
+{
     Node* child = nodeStack.top();
     if (child->nodeIsNotLeaf() && child->nodeIsNotBranch())
     {
@@ -434,16 +1034,16 @@ void RBTree<TKey,TData>::tryPop(const TKey& key)
 }
 
 template <typename TKey, typename TData>
-void RBTree<TKey,TData>::initStackOfPreviousNodesInDeletionOrThrowException(
-        std::stack<Node*> &nodeStack, 
+bool RBTree<TKey,TData>::initStackOfPreviousNodesInDeletion(
+        NodeStack& nodeStack, 
         const TKey& keyToFind) const {
 
     Node* nodePtr = head;
     while (nodePtr)
     {
         nodeStack.push(nodePtr);
-        const TKey& nodePtrKey = nodePtr->keysAndValues.front().key;
-        int compareResult = comparatorStrategy->compare(nodePtrKey, keyToFind);
+        const TKey& nodePtrKey = nodePtr->key;
+        int compareResult = compareKeys(nodePtrKey, keyToFind);
 
         if (compareResult < 0)
         {
@@ -455,14 +1055,14 @@ void RBTree<TKey,TData>::initStackOfPreviousNodesInDeletionOrThrowException(
         }
         else
         {
-            return;
+            return true;
         }
     }
-    throw std::invalid_argument("No element in tree!");
+    return false;
 }
 
 template <typename TKey, typename TData>
-void RBTree<TKey,TData>::findMaxNodeInLeftBranchAndUpdateStack(std::stack<Node*>& nodeStack) const
+void RBTree<TKey,TData>::findMaxNodeInLeftBranchAndUpdateStack(NodeStack& nodeStack) const
 {
     Node* child = nodeStack.top();
     Node* minimalNode = child->leftPtr;
@@ -478,23 +1078,23 @@ void RBTree<TKey,TData>::findMaxNodeInLeftBranchAndUpdateStack(std::stack<Node*>
 }
 
 template <typename TKey, typename TData>
-void RBTree<TKey,TData>::deleteLeafOrBranch(std::stack<Node*>& nodeStack)
+void RBTree<TKey,TData>::deleteLeafOrBranch(NodeStack& nodeStack)
 {
     Node* childToDelete = pullOutNodeFromStack(nodeStack);
-    Node child = *childToDelete;
-    Node* childPtr = &child;
+    bool childIsRedOrBranch = childToDelete->nodeIsRed() || childToDelete->nodeIsBranch();
+    Node* childPtr = nullptr; // the deleted node is unlinked, so its brother is father's other child
 
     Node* father = pullOutNodeFromStack(nodeStack);
 
     if (numberOfNodes == 1)
     {
-        delete head;
+        destroyNode(head);
         numberOfNodes = 0;
         head = nullptr;
         return;
     }
 
-    if (child.nodeIsRed() || child.nodeIsBranch())
+    if (childIsRedOrBranch)
     {
         deleteBranchOrRedLeaf(childToDelete, father);
         return;
@@ -516,22 +1116,22 @@ void RBTree<TKey,TData>::deleteLeafOrBranch(std::stack<Node*>& nodeStack)
                     makeSingleTurn(father, redNephew);
                     hangNodesAfterTurn(brother, nodeStack);
 
-                    brother->makeRed();
-                    father->makeBlack();
-                    redNephew->makeBlack();
+                    repaintRed(brother);
+                    repaintBlack(father);
+                    repaintBlack(redNephew);
                 }
                 else
                 {
                     makeDoubleTurn(father, redNephew);
                     hangNodesAfterTurn(redNephew, nodeStack);
 
-                    father->makeBlack();
+                    repaintBlack(father);
                 }
             } 
             else
             {
-                father->makeBlack();
-                brother->makeRed();
+                repaintBlack(father);
+                repaintRed(brother);
             }
             return;
         }
@@ -543,33 +1143,33 @@ void RBTree<TKey,TData>::deleteLeafOrBranch(std::stack<Node*>& nodeStack)
 
                 if (brother->redGrandsonExists())
                 {
-                    Node* brotherGrandson = brother->returnGrandsonByZigzag(father, comparatorStrategy);
+                    Node* brotherGrandson = brother->returnGrandsonByZigzag(father, this);
                     if (brotherGrandson && brotherGrandson->nodeIsRed())
                     {
-                        blackNephew = brother->returnSon(brotherGrandson, comparatorStrategy);
+                        blackNephew = brother->returnSon(brotherGrandson, this);
                 
                         makeDoubleTurn(father, blackNephew);
                         hangNodesAfterTurn(blackNephew, nodeStack);
 
-                        brotherGrandson->makeBlack();
+                        repaintBlack(brotherGrandson);
                         return;
                     }
                     
-                    blackNephew = brother->returnSonByZigzag(father, comparatorStrategy);
+                    blackNephew = brother->returnSonByZigzag(father, this);
                     brotherGrandson = blackNephew->returnAnotherChild(brotherGrandson);
                     if (brotherGrandson && brotherGrandson->nodeIsRed())
                     {
                         makeSingleTurn(father, brother->returnAnotherChild(blackNephew));
                         hangNodesAfterTurn(brother, nodeStack);
-                        brother->makeBlack();
+                        repaintBlack(brother);
 
                         makeDoubleTurn(father, brotherGrandson);
                         hangNodesAfterTurn(brotherGrandson, brother);
                         return;
                     }
                     
-                    blackNephew->makeRed();
-                    brother->makeBlack();
+                    repaintRed(blackNephew);
+                    repaintBlack(brother);
 
                     blackNephew = brother->returnAnotherChild(blackNephew);
                     makeSingleTurn(father, blackNephew);
@@ -592,8 +1192,8 @@ void RBTree<TKey,TData>::deleteLeafOrBranch(std::stack<Node*>& nodeStack)
                         hangNodesAfterTurn(blackNephew, nodeStack);
                     }
 
-                    brother->makeBlack();
-                    anotherBlackNephew->makeRed();
+                    repaintBlack(brother);
+                    repaintRed(anotherBlackNephew);
                 }
                 return;
             }
@@ -611,12 +1211,12 @@ void RBTree<TKey,TData>::deleteLeafOrBranch(std::stack<Node*>& nodeStack)
                         makeDoubleTurn(father, redNephew);
                         hangNodesAfterTurn(redNephew, nodeStack);
                     }
-                    redNephew->makeBlack();
+                    repaintBlack(redNephew);
                     return;
                 }
                 else
                 {
-                    brother->makeRed();
+                    repaintRed(brother);
                     childPtr = father;
                     father = pullOutNodeFromStack(nodeStack);
                 }
@@ -633,7 +1233,7 @@ void RBTree<TKey,TData>::deleteNode(Node* toDelete, Node* father)
     else
         father->rightPtr = nullptr;
 
-    delete toDelete;
+    destroyNode(toDelete);
     numberOfNodes--;
 }
 
@@ -665,17 +1265,17 @@ void RBTree<TKey,TData>:: deleteBranch(Node* toDelete, Node* father)
 
     if (father)
     {
-        const TKey& fatherKey = father->keysAndValues.front().key;
-        const TKey& toHangKey = toHang->keysAndValues.front().key;
-        comparatorStrategy->compare(fatherKey, toHangKey) < 0 ? father->rightPtr = toHang : father->leftPtr = toHang;
+        const TKey& fatherKey = father->key;
+        const TKey& toHangKey = toHang->key;
+        compareKeys(fatherKey, toHangKey) < 0 ? father->rightPtr = toHang : father->leftPtr = toHang;
     }
     else {
         head = toHang;
     }
-    toHang->makeBlack();
+    repaintBlack(toHang);
 
     numberOfNodes--;
-    delete toDelete;
+    destroyNode(toDelete);
 }
 
 template <typename TKey, typename TData>
@@ -690,21 +1290,62 @@ void RBTree<TKey,TData>::deleteRedLeaf(Node* toDelete, Node* father)
         father->leftPtr = nullptr;
     }
     numberOfNodes--;
-    delete toDelete;
+    destroyNode(toDelete);
 }
 
 
 template <typename TKey, typename TData>
 std::list<TData> RBTree<TKey, TData>::find(const TKey& key) const
 {
-    Node* ptr = head;
-    while (ptr)
+    Node* node = findNode(key);
+    if (node)
     {
-        const TKey& ptrKey = ptr->keysAndValues.front().key;
-        int compareCurrentAndNeededKeys = comparatorStrategy->compare(ptrKey, key);
-        if (compareCurrentAndNeededKeys < 0)
-        {
-            ptr = ptr->rightPtr;
+        return node->returnData();
+    }
+    return std::list<TData>();
+}
+
+// At most limit values of the key, skipping the first offset of them.
+template <typename TKey, typename TData>
+std::list<TData> RBTree<TKey, TData>::findPage(const TKey& key, size_t offset, size_t limit) const
+{
+    std::list<TData> page;
+    Node* node = findNode(key);
+    if (node == nullptr || offset >= node->values.size())
+    {
+        return page;
+    }
+
+    auto value = node->values.begin();
+    std::advance(value, offset);
+    for (; value != node->values.end() && page.size() < limit; ++value)
+    {
+        page.push_back(*value);
+    }
+    return page;
+}
+
+// Number of values stored with the key.
+template <typename TKey, typename TData>
+size_t RBTree<TKey, TData>::count(const TKey& key) const
+{
+    Node* node = findNode(key);
+    return node ? node->values.size() : 0;
+}
+
+template <typename TKey, typename TData>
+typename RBTree<TKey, TData>::Node* RBTree<TKey, TData>::findNode(const TKey& key) const
+{
+    Node* ptr = head;
+    size_t depth = 0;
+    while (ptr)
+    {
+        depth++;
+        const TKey& ptrKey = ptr->key;
+        int compareCurrentAndNeededKeys = compareKeys(ptrKey, key);
+        if (compareCurrentAndNeededKeys < 0)
+        {
+            ptr = ptr->rightPtr;
         }
         else if (compareCurrentAndNeededKeys > 0)
         {
@@ -712,95 +1353,218 @@ std::list<TData> RBTree<TKey, TData>::find(const TKey& key) const
         }
         else
         {
-            return ptr->returnData();
+            break;
         }
     }
-    throw std::invalid_argument("No element in tree!");
+    RBTREE_COUNT_SEARCH(depth);
+    return ptr;
 }
 
 
 template <typename TKey, typename TData>
-void RBTree<TKey, TData>::print(void (*function)(const TKey&, const TData&))
+typename RBTree<TKey, TData>::Iterator RBTree<TKey, TData>::findIterator(const TKey& key) const
 {
-    if (!function)
+    NodeStack nodeStack;
+    if (head == nullptr || initStackOfPreviousNodesInInsert(nodeStack, key) != 0)
+    {
+        return end();
+    }
+    return Iterator(this, nodeStack);
+}
+
+// First key that is not less than key.
+template <typename TKey, typename TData>
+typename RBTree<TKey, TData>::Iterator RBTree<TKey, TData>::lowerBound(const TKey& key) const
+{
+    NodeStack nodeStack;
+    if (head == nullptr)
     {
-        std::cout << "No function" << std::endl;
+        return end();
+    }
+
+    int compareResult = initStackOfPreviousNodesInInsert(nodeStack, key);
+    if (compareResult < 0)
+    {
+        moveToNext(nodeStack);
+    }
+    return Iterator(this, nodeStack);
+}
+
+template <typename TKey, typename TData>
+typename RBTree<TKey, TData>::Iterator RBTree<TKey, TData>::begin() const
+{
+    NodeStack nodeStack;
+    pushLeftmostPath(nodeStack, head);
+    return Iterator(this, nodeStack);
+}
+
+template <typename TKey, typename TData>
+typename RBTree<TKey, TData>::Iterator RBTree<TKey, TData>::end() const
+{
+    return Iterator(this, NodeStack());
+}
+
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::moveToNext(NodeStack& nodeStack)
+{
+    Node* node = nodeStack.top();
+    if (node->rightPtr)
+    {
+        nodeStack.push(node->rightPtr);
+        node = node->rightPtr;
+        while (node->leftPtr)
+        {
+            node = node->leftPtr;
+            nodeStack.push(node);
+        }
         return;
     }
 
-    if (head)
+    nodeStack.pop();
+    while (!nodeStack.empty() && nodeStack.top()->rightPtr == node)
     {
-        std::cout << "Size " << numberOfNodes << std::endl; 
-        doPrint(function, head);
+        node = nodeStack.top();
+        nodeStack.pop();
     }
-    else
-        std::cout << "Tree is empty!" << std::endl;
-    // this->function = function; // to save
 }
 
 template <typename TKey, typename TData>
-void RBTree<TKey, TData>::doPrint(void (*function)(const TKey&, const TData&), Node* startNode) const
+void RBTree<TKey, TData>::moveToPrevious(NodeStack& nodeStack)
 {
-    startNode->log(function);
+    Node* node = nodeStack.top();
+    if (node->leftPtr)
+    {
+        nodeStack.push(node->leftPtr);
+        node = node->leftPtr;
+        while (node->rightPtr)
+        {
+            node = node->rightPtr;
+            nodeStack.push(node);
+        }
+        return;
+    }
 
-    if (startNode->leftPtr)
+    nodeStack.pop();
+    while (!nodeStack.empty() && nodeStack.top()->leftPtr == node)
     {
-        doPrint(function, startNode->leftPtr);
+        node = nodeStack.top();
+        nodeStack.pop();
     }
-    if (startNode->rightPtr)
+}
+
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::pushLeftmostPath(NodeStack& nodeStack, Node* startNode) const
+{
+    for (Node* node = startNode; node; node = node->leftPtr)
     {
-        doPrint(function, startNode->rightPtr);
+        nodeStack.push(node);
     }
 }
 
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::pushRightmostPath(NodeStack& nodeStack, Node* startNode) const
+{
+    for (Node* node = startNode; node; node = node->rightPtr)
+    {
+        nodeStack.push(node);
+    }
+}
 
+// Extends a valid path from head until it ends at the node holding key.
 template <typename TKey, typename TData>
-void RBTree<TKey, TData>::hangNodesAfterTurn(Node* nodeToHang, std::stack<Node*>& nodeStack)
+void RBTree<TKey, TData>::descendToKey(NodeStack& nodeStack, const TKey& key) const
 {
     if (nodeStack.empty())
     {
-        head = nodeToHang;
-        return;
+        nodeStack.push(head);
     }
 
-    Node* previousNode = nodeStack.top();
+    int compareResult = compareKeys(nodeStack.top()->key, key);
+    while (compareResult != 0)
+    {
+        nodeStack.push(compareResult < 0 ? nodeStack.top()->rightPtr : nodeStack.top()->leftPtr);
+        compareResult = compareKeys(nodeStack.top()->key, key);
+    }
+}
 
-    const TKey& previousNodeKey = previousNode->keysAndValues.front().key;
-    const TKey& nodeToHangKey = nodeToHang->keysAndValues.back().key;
 
-    int compareNodes = comparatorStrategy->compare(previousNodeKey, nodeToHangKey);
-    compareNodes < 0 ? previousNode->rightPtr = nodeToHang : previousNode->leftPtr = nodeToHang;
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::print(std::ostream& out, void (*function)(const TKey&, const TData&)) const
+{
+    if (!function)
+    {
+        out << "No function" << '\n';
+        return;
+    }
+
+    if (head)
+    {
+        out << "Size " << numberOfNodes << '\n'; 
+        doPrint(out, function, head);
+    }
+    else
+        out << "Tree is empty!" << '\n';
+    // this->function = function; // to save
 }
 
 template <typename TKey, typename TData>
-void RBTree<TKey, TData>::hangNodesAfterTurn(Node* nodeToHang, Node* previousNode) const
+void RBTree<TKey, TData>::doPrint(std::ostream& out, void (*function)(const TKey&, const TData&), Node* startNode) const
 {
-    const TKey& previousNodeKey = previousNode->keysAndValues.front().key;
-    const TKey& nodeToHangKey = nodeToHang->keysAndValues.back().key;
+    NodeStack nodesToPrint;
+    nodesToPrint.push(startNode);
+    while (!nodesToPrint.empty())
+    {
+        Node* node = pullOutNodeFromStack(nodesToPrint);
+        node->log(out, function);
 
-    int compareNodes = comparatorStrategy->compare(previousNodeKey, nodeToHangKey);
-    compareNodes < 0 ? previousNode->rightPtr = nodeToHang : previousNode->leftPtr = nodeToHang;
+        if (node->rightPtr)
+        {
+            nodesToPrint.push(node->rightPtr);
+        }
+        if (node->leftPtr)
+        {
+            nodesToPrint.push(node->leftPtr);
+        }
+    }
 }
 
+
 template <typename TKey, typename TData>
-bool RBTree<TKey, TData>::needToMakeSingleTurn(Node*grandfather, Node* grandson) const
+void RBTree<TKey, TData>::hangNodesAfterTurn(Node* nodeToHang, NodeStack& nodeStack)
 {
-    Node* father = returnFather(grandfather, grandson);
+    if (nodeStack.empty())
+    {
+        head = nodeToHang;
+        return;
+    }
 
-    const TKey& grandfatherKey = grandfather->keysAndValues.front().key;
-    const TKey& fatherKey = father->keysAndValues.front().key;
-    const TKey& grandsonKey = grandson->keysAndValues.front().key;
+    hangNodesAfterTurn(nodeToHang, nodeStack.top());
+}
 
-    int compareGrandfatherAndFather = comparatorStrategy->compare(grandfatherKey, fatherKey);
-    int compareFatherAndGrandson = comparatorStrategy->compare(fatherKey, grandsonKey);
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::hangNodesAfterTurn(Node* nodeToHang, Node* previousNode) const
+{
+    // previousNode still points at the old root of the turned subtree, which
+    // is a child of nodeToHang now.
+    Node* oldRoot = previousNode->leftPtr;
+    if (oldRoot != nullptr && (nodeToHang->leftPtr == oldRoot || nodeToHang->rightPtr == oldRoot))
+        previousNode->leftPtr = nodeToHang;
+    else
+        previousNode->rightPtr = nodeToHang;
+}
 
-    return compareGrandfatherAndFather == compareFatherAndGrandson;
+template <typename TKey, typename TData>
+bool RBTree<TKey, TData>::needToMakeSingleTurn(Node*grandfather, Node* grandson) const
+{
+    Node* father = returnFather(grandfather, grandson);
+    return (grandfather->leftPtr == father) == (father->leftPtr == grandson);
 }
 
 template <typename TKey, typename TData>
 void RBTree<TKey, TData>::makeSingleTurn(Node* grandfather, Node* grandson) const
 {
     Node* father = returnFather(grandfather, grandson);
+    RBTREE_COUNT(singleRotations, 1);
 
     if (father->rightPtr == grandson)
     {
@@ -818,6 +1582,7 @@ template <typename TKey, typename TData>
 void RBTree<TKey,TData>::makeDoubleTurn(Node* grandfather, Node* grandson) const
 {
     Node *father = returnFather(grandfather, grandson);
+    RBTREE_COUNT(doubleRotations, 1);
 
     if (father->leftPtr == grandson)
     {
@@ -838,14 +1603,17 @@ void RBTree<TKey,TData>::makeDoubleTurn(Node* grandfather, Node* grandson) const
 }
 
 template <typename TKey, typename TData>
-void RBTree<TKey,TData>::throwExceptionIfThereIsNoCompare() const
+bool RBTree<TKey,TData>::comparatorIsMissing() const
 {
-    if (comparatorStrategy == nullptr)
-        throw std::overflow_error("Can't use Compare!");
+    if (comparatorStrategy != nullptr)
+        return false;
+
+    reportError("Can't use Compare!");
+    return true;
 }
 
 template <typename TKey, typename TData>
-typename RBTree<TKey, TData>::Node* RBTree<TKey, TData>::pullOutNodeFromStack(std::stack<Node*>& nodeStack) const
+typename RBTree<TKey, TData>::Node* RBTree<TKey, TData>::pullOutNodeFromStack(NodeStack& nodeStack) const
 {
     if (nodeStack.size() == 0)
         return nullptr;
@@ -858,12 +1626,9 @@ typename RBTree<TKey, TData>::Node* RBTree<TKey, TData>::pullOutNodeFromStack(st
 template <typename TKey, typename TData>
 typename RBTree<TKey,TData>::Node* RBTree<TKey, TData>::returnFather(Node* grandfather, Node* grandson) const
 {
-    const TKey& grandfatherKey = grandfather->keysAndValues.front().key;
-    const TKey& grandsonKey = grandson->keysAndValues.front().key;
-    int compareGrandfatherAndGrandson = comparatorStrategy->compare(grandfatherKey, grandsonKey);
-
-    Node *father;
-    compareGrandfatherAndGrandson < 0 ? father = grandfather->rightPtr : father = grandfather->leftPtr;
+    Node* father = grandfather->leftPtr;
+    if (father == nullptr || (father->leftPtr != grandson && father->rightPtr != grandson))
+        father = grandfather->rightPtr;
     return father;
 }
 
@@ -876,41 +1641,470 @@ bool RBTree<TKey,TData>::isEmpty() const
 template <typename TKey, typename TData>
 void RBTree<TKey,TData>::swapNodes(Node* first, Node* second) const
 {
-    const std::list<KeyAndValue>& firstKeysAndValues = first->keysAndValues;
-    
-    first->keysAndValues = second->keysAndValues;
-    second->keysAndValues = firstKeysAndValues;
+    std::swap(first->key, second->key);
+    first->values.swap(second->values);
 }
 
 template <typename TKey, typename TData>
-RBTree<TKey,TData>::~RBTree()
+RBTreeStatistics RBTree<TKey, TData>::getStatistics() const
 {
-    
-    // while (head)
-    // {
-    //     const TKey& key = head->keysAndValues.front().key;
-    //     this->pop(key);
-    // }
+#ifdef RBTREE_ENABLE_STATISTICS
+    return statisticsCounters;
+#else
+    return RBTreeStatistics();
+#endif
+}
 
-    if (head)
-        makeRecursiveRemovalOfNodeForDestructor(head);
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::resetStatistics()
+{
+#ifdef RBTREE_ENABLE_STATISTICS
+    statisticsCounters = RBTreeStatistics();
+    statisticsCounters.enabled = true;
+#endif
+}
+
+template <typename TKey, typename TData>
+int RBTree<TKey, TData>::compareKeys(const TKey& first, const TKey& second) const
+{
+    RBTREE_COUNT(comparisons, 1);
+    return comparatorStrategy->compare(first, second);
+}
+
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::repaintRed(Node* node) const
+{
+    RBTREE_COUNT(recolorings, node->nodeIsBlack());
+    node->makeRed();
+}
 
-    std::cout << "Success" << std::endl;
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::repaintBlack(Node* node) const
+{
+    RBTREE_COUNT(recolorings, node->nodeIsRed());
+    node->makeBlack();
 }
 
 template <typename TKey, typename TData>
-void RBTree<TKey,TData>::makeRecursiveRemovalOfNodeForDestructor(Node* ptr) const
+void* RBTree<TKey, TData>::allocateNode()
 {
-    if (ptr->leftPtr)
+    if (freeNodes)
     {
-        makeRecursiveRemovalOfNodeForDestructor(ptr->leftPtr);
+        FreeNode* freeNode = freeNodes;
+        freeNodes = freeNode->next;
+        numberOfFreeNodes--;
+        return freeNode;
     }
 
-    if (ptr->rightPtr)
+    RBTREE_COUNT(nodeAllocations, 1);
+    return ::operator new(sizeof(Node));
+}
+
+template <typename TKey, typename TData>
+typename RBTree<TKey, TData>::Node* RBTree<TKey, TData>::createNode(const TKey& key, const TData& data)
+{
+    Node* node = new (allocateNode()) Node(key, data);
+    RBTREE_COUNT(chunkAllocations, node->values.chunkCount());
+    countValuesOf(node);
+    return node;
+}
+
+template <typename TKey, typename TData>
+typename RBTree<TKey, TData>::Node* RBTree<TKey, TData>::createNodeCopy(const Node* node)
+{
+    Node* copy = new (allocateNode()) Node(*node);
+    copy->leftPtr = nullptr;
+    copy->rightPtr = nullptr;
+    RBTREE_COUNT(chunkAllocations, copy->values.chunkCount());
+    countValuesOf(copy);
+    return copy;
+}
+
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::destroyNode(Node* node)
+{
+    RBTREE_COUNT(nodeDeallocations, 1);
+    RBTREE_COUNT(chunkDeallocations, node->values.chunkCount());
+    uncountValuesOf(node);
+    node->~Node();
+    ::operator delete(node);
+}
+
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::recycleNode(Node* node)
+{
+    RBTREE_COUNT(chunkDeallocations, node->values.chunkCount());
+    uncountValuesOf(node);
+    node->~Node();
+    freeNodes = new (static_cast<void*>(node)) FreeNode{freeNodes};
+    numberOfFreeNodes++;
+}
+
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::releaseFreeNodes()
+{
+    while (freeNodes)
     {
-        makeRecursiveRemovalOfNodeForDestructor(ptr->rightPtr);
+        FreeNode* freeNode = freeNodes;
+        freeNodes = freeNode->next;
+
+        RBTREE_COUNT(nodeDeallocations, 1);
+        ::operator delete(freeNode);
     }
+    numberOfFreeNodes = 0;
+}
 
-    delete ptr;
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::countSearch(size_t depth) const
+{
+#ifdef RBTREE_ENABLE_STATISTICS
+    size_t bucket = depth < RBTreeStatistics::depthHistogramSize ? depth : RBTreeStatistics::depthHistogramSize - 1;
+    statisticsCounters.searches++;
+    statisticsCounters.searchDepthHistogram[bucket]++;
+#else
+    (void)depth;
+#endif
 }
 
+// Number of stored values, like std::multimap::size().
+template <typename TKey, typename TData>
+size_t RBTree<TKey, TData>::size() const
+{
+    return numberOfValues;
+}
+
+template <typename TKey, typename TData>
+size_t RBTree<TKey, TData>::keyCount() const
+{
+    return numberOfNodes;
+}
+
+template <typename TKey, typename TData>
+size_t RBTree<TKey, TData>::valueCount() const
+{
+    return numberOfValues;
+}
+
+// O(1): the counters behind it change with every insert and erase.
+template <typename TKey, typename TData>
+RBTreeMemoryUsage RBTree<TKey, TData>::memoryUsage() const
+{
+    RBTreeMemoryUsage usage;
+    usage.nodeBytes = numberOfNodes * sizeof(Node);
+    usage.valueBytes = numberOfValues * sizeof(TData);
+    usage.slackBytes = numberOfFreeNodes * sizeof(Node) + (valueStorageBytes - usage.valueBytes);
+    usage.userBytes = userBytes;
+    usage.totalBytes = usage.nodeBytes + usage.valueBytes + usage.slackBytes + usage.userBytes;
+    return usage;
+}
+
+// hook returns the heap bytes a value owns, e.g. the capacity of a string.
+// It is called once when a value is stored and once when it is removed, so
+// it must return the same result for an unchanged value. Values that
+// upsert() or update() change are measured again. Setting the hook walks
+// the whole tree once.
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::setMemoryUsageHook(size_t (*memoryUsageHook)(const TData& data))
+{
+    this->memoryUsageHook = memoryUsageHook;
+    userBytes = 0;
+    for (Iterator node = begin(); node != end(); ++node)
+    {
+        userBytes += userBytesOf(node.values(), node.values().size());
+    }
+}
+
+// Checks in O(n) that keys ascend, the root is black, no red node has a red
+// child, every path from the root down to a missing child passes the same
+// number of black nodes, no node is empty and the counters agree with the
+// nodes. Reports the first violation through the error handler.
+template <typename TKey, typename TData>
+bool RBTree<TKey, TData>::validate() const
+{
+    if (head == nullptr)
+    {
+        if (numberOfNodes != 0 || numberOfValues != 0 || valueStorageBytes != 0 || userBytes != 0)
+        {
+            reportError("Empty tree has values counted!");
+            return false;
+        }
+        return true;
+    }
+
+    if (comparatorIsMissing())
+    {
+        return false;
+    }
+
+    if (head->nodeIsRed())
+    {
+        reportError("Root is red!");
+        return false;
+    }
+
+    size_t blackHeight = 0;
+    for (const Node* node = head; node; node = node->leftPtr)
+    {
+        blackHeight += node->nodeIsBlack();
+    }
+
+    // Keys ascend if every node lies strictly between the nearest ancestors
+    // it hangs right and left of; nullptr stands for no such ancestor.
+    struct NodeToCheck
+    {
+        const Node* node;
+        size_t blackNodes;
+        const TKey* lowerKey;
+        const TKey* upperKey;
+    };
+
+    size_t nodes = 0, values = 0, storageBytes = 0, hookBytes = 0;
+    std::stack<NodeToCheck> nodesToCheck;
+    nodesToCheck.push(NodeToCheck{head, 1, nullptr, nullptr});
+    while (!nodesToCheck.empty())
+    {
+        NodeToCheck check = nodesToCheck.top();
+        const Node* node = check.node;
+        nodesToCheck.pop();
+
+        if ((check.lowerKey && comparatorStrategy->compare(*check.lowerKey, node->key) >= 0)
+            || (check.upperKey && comparatorStrategy->compare(node->key, *check.upperKey) >= 0))
+        {
+            reportError("Keys are out of order!");
+            return false;
+        }
+        if (node->values.empty())
+        {
+            reportError("Node has no values!");
+            return false;
+        }
+        if (node->nodeIsRed() && node->returnRedChildOrNullptr())
+        {
+            reportError("Red node has a red child!");
+            return false;
+        }
+
+        nodes++;
+        values += node->values.size();
+        storageBytes += node->values.allocatedBytes();
+        hookBytes += userBytesOf(node->values, node->values.size());
+
+        for (const Node* child : {node->leftPtr, node->rightPtr})
+        {
+            if (child)
+            {
+                bool isLeft = child == node->leftPtr;
+                nodesToCheck.push(NodeToCheck{child, check.blackNodes + child->nodeIsBlack(),
+                        isLeft ? check.lowerKey : &node->key, isLeft ? &node->key : check.upperKey});
+            }
+            else if (check.blackNodes != blackHeight)
+            {
+                reportError("Black heights differ!");
+                return false;
+            }
+        }
+    }
+
+    if (nodes != numberOfNodes || values != numberOfValues || storageBytes != valueStorageBytes || hookBytes != userBytes)
+    {
+        reportError("Counters don't match the nodes!");
+        return false;
+    }
+    return true;
+}
+
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::appendValue(Node* node, const TData& data)
+{
+    size_t bytesBefore = node->values.allocatedBytes();
+    node->values.pushBack(data);
+    RBTREE_COUNT(chunkAllocations, node->values.allocatedBytes() != bytesBefore);
+    valueStorageBytes += node->values.allocatedBytes() - bytesBefore;
+    numberOfValues++;
+    userBytes += userBytesOf(data);
+}
+
+template <typename TKey, typename TData>
+template <typename TFunction>
+void RBTree<TKey, TData>::modifyFirstValue(Node* node, TFunction function)
+{
+    TData& value = node->values.front();
+    userBytes -= userBytesOf(value);
+    function(value);
+    userBytes += userBytesOf(value);
+}
+
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::countValuesOf(const Node* node)
+{
+    numberOfValues += node->values.size();
+    valueStorageBytes += node->values.allocatedBytes();
+    userBytes += userBytesOf(node->values, node->values.size());
+}
+
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::uncountValuesOf(const Node* node)
+{
+    numberOfValues -= node->values.size();
+    valueStorageBytes -= node->values.allocatedBytes();
+    userBytes -= userBytesOf(node->values, node->values.size());
+}
+
+template <typename TKey, typename TData>
+size_t RBTree<TKey, TData>::userBytesOf(const TData& data) const
+{
+    return memoryUsageHook ? memoryUsageHook(data) : 0;
+}
+
+// Hook bytes of the first count values.
+template <typename TKey, typename TData>
+size_t RBTree<TKey, TData>::userBytesOf(const ChunkedList<TData>& values, size_t count) const
+{
+    if (memoryUsageHook == nullptr)
+        return 0;
+
+    size_t bytes = 0;
+    for (auto value = values.begin(); value != values.end() && count > 0; ++value, count--)
+    {
+        bytes += memoryUsageHook(*value);
+    }
+    return bytes;
+}
+
+template <typename TKey, typename TData>
+RBTree<TKey, TData>::RBTree(const RBTree& tree) : Tree<TKey, TData>(tree)
+{
+    head = nullptr;
+    numberOfNodes = 0;
+    comparatorStrategy = tree.comparatorStrategy;
+    function = tree.function;
+    errorHandler = tree.errorHandler;
+    memoryUsageHook = tree.memoryUsageHook;
+    resetStatistics();
+
+    try
+    {
+        copyNodesOf(tree);
+    }
+    catch (...)
+    {
+        removeAllNodes(false);
+        throw;
+    }
+}
+
+// Clones the shape and colors of the tree node by node, so the copy needs
+// no comparisons and no rebalancing.
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::copyNodesOf(const RBTree& tree)
+{
+    if (tree.head == nullptr)
+        return;
+
+    head = createNodeCopy(tree.head);
+    numberOfNodes = 1;
+
+    std::stack<std::pair<const Node*, Node*>> nodesToCopy;
+    nodesToCopy.push(std::make_pair(tree.head, head));
+    while (!nodesToCopy.empty())
+    {
+        const Node* original = nodesToCopy.top().first;
+        Node* copy = nodesToCopy.top().second;
+        nodesToCopy.pop();
+
+        if (original->leftPtr)
+        {
+            copy->leftPtr = createNodeCopy(original->leftPtr);
+            numberOfNodes++;
+            nodesToCopy.push(std::make_pair(original->leftPtr, copy->leftPtr));
+        }
+        if (original->rightPtr)
+        {
+            copy->rightPtr = createNodeCopy(original->rightPtr);
+            numberOfNodes++;
+            nodesToCopy.push(std::make_pair(original->rightPtr, copy->rightPtr));
+        }
+    }
+}
+
+template <typename TKey, typename TData>
+RBTree<TKey, TData>::RBTree(RBTree&& tree) noexcept : Tree<TKey, TData>(tree)
+{
+    head = nullptr;
+    numberOfNodes = 0;
+    comparatorStrategy = tree.comparatorStrategy;
+    function = tree.function;
+    errorHandler = tree.errorHandler;
+    resetStatistics();
+
+    swap(tree);
+}
+
+template <typename TKey, typename TData>
+RBTree<TKey, TData>& RBTree<TKey, TData>::operator=(RBTree tree) noexcept
+{
+    swap(tree);
+    return *this;
+}
+
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::swap(RBTree& tree) noexcept
+{
+    std::swap(head, tree.head);
+    std::swap(comparatorStrategy, tree.comparatorStrategy);
+    std::swap(numberOfNodes, tree.numberOfNodes);
+    std::swap(function, tree.function);
+    std::swap(errorHandler, tree.errorHandler);
+    std::swap(freeNodes, tree.freeNodes);
+    std::swap(numberOfFreeNodes, tree.numberOfFreeNodes);
+    std::swap(numberOfValues, tree.numberOfValues);
+    std::swap(valueStorageBytes, tree.valueStorageBytes);
+    std::swap(userBytes, tree.userBytes);
+    std::swap(memoryUsageHook, tree.memoryUsageHook);
+#ifdef RBTREE_ENABLE_STATISTICS
+    std::swap(statisticsCounters, tree.statisticsCounters);
+#endif
+}
+
+// With keepNodesForReuse the node memory stays with the tree and is handed
+// out again by the following inserts instead of going back to the heap.
+template <typename TKey, typename TData>
+void RBTree<TKey, TData>::clear(bool keepNodesForReuse)
+{
+    removeAllNodes(keepNodesForReuse);
+    if (!keepNodesForReuse)
+        releaseFreeNodes();
+}
+
+template <typename TKey, typename TData>
+RBTree<TKey,TData>::~RBTree()
+{
+    removeAllNodes(false);
+    releaseFreeNodes();
+}
+
+// Rotates left children up until the current node has none, then frees it
+// and continues with its right child: O(n) time without recursion or stack.
+template <typename TKey, typename TData>
+void RBTree<TKey,TData>::removeAllNodes(bool keepNodesForReuse)
+{
+    Node* ptr = head;
+    while (ptr)
+    {
+        if (ptr->leftPtr)
+        {
+            Node* leftChild = ptr->leftPtr;
+            ptr->leftPtr = leftChild->rightPtr;
+            leftChild->rightPtr = ptr;
+            ptr = leftChild;
+            continue;
+        }
+
+        Node* rightChild = ptr->rightPtr;
+        keepNodesForReuse ? recycleNode(ptr) : destroyNode(ptr);
+        ptr = rightChild;
+    }
+
+    head = nullptr;
+    numberOfNodes = 0;
+}
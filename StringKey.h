@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include "comparators/ComparatorStrategy.h"
+
+// String key for RBTree. The first 8 bytes are kept as a big-endian integer,
+// so two keys with different prefixes are ordered by one integer compare.
+// Only the bytes after the prefix are stored as characters: inline for keys
+// up to 24 bytes, on the heap for longer ones.
+//
+// What pays off is the inline storage: a key of up to 24 bytes needs no
+// allocation and a descent never leaves the node. Keys that share their first
+// 8 bytes, such as URLs, always tie on the integer and are ordered by the
+// memcmp of their tails, so on those StringKey is no faster than std::string.
+class StringKey
+{
+public:
+    static const size_t prefixLength = sizeof(uint64_t);
+    static const size_t inlineTailCapacity = 16;
+
+private:
+    uint64_t prefix;
+    size_t length;
+    union
+    {
+        char inlineTail[inlineTailCapacity];
+        char* heapTail;
+    };
+
+public:
+    StringKey() : prefix(0), length(0)
+    {
+    }
+
+    StringKey(const char* string) : StringKey(string, std::strlen(string))
+    {
+    }
+
+    StringKey(const std::string& string) : StringKey(string.data(), string.size())
+    {
+    }
+
+    StringKey(const char* string, size_t size) : prefix(0), length(size)
+    {
+        size_t bytesInPrefix = length < prefixLength ? length : prefixLength;
+        for (size_t i = 0; i < bytesInPrefix; i++)
+        {
+            prefix = (prefix << 8) | static_cast<unsigned char>(string[i]);
+        }
+        if (bytesInPrefix != 0 && bytesInPrefix < prefixLength)
+        {
+            prefix <<= 8 * (prefixLength - bytesInPrefix);
+        }
+
+        if (tailIsOnHeap())
+        {
+            heapTail = new char[tailLength()];
+        }
+        std::memcpy(tail(), string + bytesInPrefix, tailLength());
+    }
+
+    StringKey(const StringKey& other) : prefix(other.prefix), length(other.length)
+    {
+        if (tailIsOnHeap())
+        {
+            heapTail = new char[tailLength()];
+        }
+        std::memcpy(tail(), other.tail(), tailLength());
+    }
+
+    StringKey(StringKey&& other) noexcept : prefix(other.prefix), length(other.length)
+    {
+        if (tailIsOnHeap())
+        {
+            heapTail = other.heapTail;
+        }
+        else
+        {
+            std::memcpy(inlineTail, other.inlineTail, inlineTailCapacity);
+        }
+        other.prefix = 0;
+        other.length = 0;
+    }
+
+    StringKey& operator=(StringKey other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~StringKey()
+    {
+        if (tailIsOnHeap())
+        {
+            delete[] heapTail;
+        }
+    }
+
+    void swap(StringKey& other) noexcept
+    {
+        char buffer[sizeof(inlineTail)];
+        std::memcpy(buffer, inlineTail, sizeof(inlineTail));
+        std::memcpy(inlineTail, other.inlineTail, sizeof(inlineTail));
+        std::memcpy(other.inlineTail, buffer, sizeof(inlineTail));
+
+        std::swap(prefix, other.prefix);
+        std::swap(length, other.length);
+    }
+
+    // Orders like std::string::compare, but always returns -1, 0 or 1:
+    // RBTree compares results of different compare calls with each other.
+    // Only keys that differ in their first 8 bytes skip the memcmp.
+    int compare(const StringKey& other) const
+    {
+        if (prefix != other.prefix)
+        {
+            return prefix < other.prefix ? -1 : 1;
+        }
+
+        size_t thisTailLength = tailLength();
+        size_t otherTailLength = other.tailLength();
+        size_t commonTailLength = thisTailLength < otherTailLength ? thisTailLength : otherTailLength;
+        if (commonTailLength != 0)
+        {
+            int compareTails = std::memcmp(tail(), other.tail(), commonTailLength);
+            if (compareTails != 0)
+            {
+                return compareTails < 0 ? -1 : 1;
+            }
+        }
+
+        if (length == other.length)
+            return 0;
+        return length < other.length ? -1 : 1;
+    }
+
+    bool operator==(const StringKey& other) const
+    {
+        return compare(other) == 0;
+    }
+    bool operator!=(const StringKey& other) const
+    {
+        return compare(other) != 0;
+    }
+    bool operator<(const StringKey& other) const
+    {
+        return compare(other) < 0;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+
+    bool isInline() const
+    {
+        return !tailIsOnHeap();
+    }
+
+    std::string toString() const
+    {
+        std::string string(length, '\0');
+        size_t bytesInPrefix = length < prefixLength ? length : prefixLength;
+        for (size_t i = 0; i < bytesInPrefix; i++)
+        {
+            string[i] = static_cast<char>(prefix >> (8 * (prefixLength - 1 - i)));
+        }
+        std::memcpy(&string[0] + bytesInPrefix, tail(), tailLength());
+        return string;
+    }
+
+private:
+    size_t tailLength() const
+    {
+        return length > prefixLength ? length - prefixLength : 0;
+    }
+
+    bool tailIsOnHeap() const
+    {
+        return tailLength() > inlineTailCapacity;
+    }
+
+    char* tail()
+    {
+        return tailIsOnHeap() ? heapTail : inlineTail;
+    }
+
+    const char* tail() const
+    {
+        return tailIsOnHeap() ? heapTail : inlineTail;
+    }
+};
+
+class StringKeyComparator : public ComparatorStrategy<StringKey>
+{
+public:
+    int compare(const StringKey& left, const StringKey& right) const override
+    {
+        return left.compare(right);
+    }
+};
@@ -0,0 +1,467 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "RedBlackTree.h"
+
+struct WriteCombiningOptions
+{
+    // Operations each producer thread can have in flight; rounded up to a
+    // power of two. A producer with a full buffer waits for the applier.
+    size_t bufferCapacity = 4096;
+    // The most operations drained, applied and published as one batch under
+    // one exclusive lock, so a reader waits for at most one batch. A producer
+    // that has pushed this many operations wakes the applier before the
+    // interval runs out.
+    size_t maxBatch = 4096;
+    // The applier drains the buffers at least this often.
+    std::chrono::microseconds flushInterval = std::chrono::microseconds(1000);
+    // Called on the applier thread for every operation once the batch that
+    // holds it is visible, with the time since its add() or pop() call
+    // started. Meant for measurements: while it is set, every push reads
+    // the clock.
+    void (*visibilityLatencyHook)(std::chrono::nanoseconds latency) = nullptr;
+};
+
+// Asynchronous front end for an RBTree written by many threads. add() and
+// pop() only push the operation into a lock-free buffer owned by the calling
+// thread. One applier thread drains the buffers in batches of at most
+// maxBatch operations, sorts each batch by key (keeping the order of
+// operations on the same key) and applies it under one exclusive lock,
+// inserting with the previous key as the hint. Operations a batch leaves in
+// the buffers go into the next one. Readers share the lock and see whole
+// batches only; version() counts the batches applied so far.
+//
+// Operations of one thread are applied in the order it pushed them: a batch
+// takes a prefix of every buffer, so a reader never sees an operation
+// without the ones its thread pushed before. Operations of different threads
+// on the same key are ordered by the batch that drains them, not by the time
+// they were pushed. Call flush() to wait until everything the calling thread
+// pushed is visible.
+//
+// Updates trade latency for throughput: a change becomes visible when the
+// applier next wakes up, up to flushInterval after the push, and later under
+// load. Use it when readers can tolerate that delay.
+template <typename TKey, typename TData>
+class WriteCombiningRBTree
+{
+private:
+    enum class OperationType
+    {
+        Add,
+        Pop
+    };
+
+    struct Operation
+    {
+        OperationType type = OperationType::Add;
+        TKey key = TKey();
+        TData data = TData();
+        std::chrono::steady_clock::time_point pushTime; // only set for the visibility latency hook
+    };
+
+    // Single-producer single-consumer ring. Only the owning thread moves tail
+    // and only the applier moves head; both only grow. The thread and the
+    // tree share it, and each marks when it lets go.
+    struct ProducerBuffer
+    {
+        std::vector<Operation> slots;
+        size_t mask;
+        alignas(64) std::atomic<size_t> head{0};
+        alignas(64) std::atomic<size_t> tail{0};
+        std::atomic<bool> producerExited{false};
+        std::atomic<bool> treeDestroyed{false};
+
+        explicit ProducerBuffer(size_t capacity) : slots(capacity), mask(capacity - 1)
+        {
+        }
+    };
+
+    // Buffers of one thread, by tree id.
+    struct ThreadBuffers
+    {
+        uint64_t lastTreeId = 0;
+        ProducerBuffer* lastBuffer = nullptr;
+        std::unordered_map<uint64_t, std::shared_ptr<ProducerBuffer>> buffers;
+
+        ~ThreadBuffers()
+        {
+            for (const auto& entry : buffers)
+            {
+                entry.second->producerExited.store(true, std::memory_order_release);
+            }
+        }
+    };
+
+    // A buffer to drain and the tail it is drained up to.
+    struct BufferToDrain
+    {
+        ProducerBuffer* buffer;
+        size_t tail;
+    };
+
+    RBTree<TKey, TData> tree;
+    ComparatorStrategy<TKey>* comparatorStrategy;
+    WriteCombiningOptions options;
+    const uint64_t treeId;
+
+    mutable std::shared_mutex treeMutex;
+    std::atomic<uint64_t> publishedVersion{0};
+
+    std::mutex applierMutex; // guards everything below
+    std::condition_variable applierWakeup;
+    std::condition_variable flushDone;
+    std::vector<std::shared_ptr<ProducerBuffer>> buffers;
+    uint64_t flushesRequested = 0;
+    uint64_t flushesDone = 0;
+    bool stopRequested = false;
+    std::atomic<bool> wakeRequested{false};
+
+    std::thread applier;
+
+public:
+    WriteCombiningRBTree(ComparatorStrategy<TKey>* comparatorStrategy, WriteCombiningOptions options = WriteCombiningOptions());
+    WriteCombiningRBTree(const WriteCombiningRBTree& tree) = delete;
+    WriteCombiningRBTree& operator=(const WriteCombiningRBTree& tree) = delete;
+    ~WriteCombiningRBTree();
+
+    void setErrorHandler(void (*errorHandler)(const char* message));
+
+public:
+    void add(const TKey& key, const TData& data);
+    void pop(const TKey& key);
+    void flush();
+private:
+    void push(OperationType type, const TKey& key, const TData& data);
+    ProducerBuffer* bufferOfThisThread();
+    std::shared_ptr<ProducerBuffer> registerBuffer();
+    void wakeApplier();
+
+public:
+    std::list<TData> find(const TKey& key) const;
+    template <typename TFunction>
+    void read(TFunction function) const;
+    uint64_t version() const;
+
+private:
+    void runApplier();
+    void removeExitedBuffers();
+    bool drainBuffers(const std::vector<BufferToDrain>& buffersToDrain, std::vector<Operation>& batch);
+    void applyBatch(std::vector<Operation>& batch);
+};
+
+template <typename TKey, typename TData>
+WriteCombiningRBTree<TKey, TData>::WriteCombiningRBTree(
+        ComparatorStrategy<TKey>* comparatorStrategy,
+        WriteCombiningOptions options)
+    : tree(comparatorStrategy),
+      comparatorStrategy(comparatorStrategy),
+      options(options),
+      treeId([]()
+      {
+          static std::atomic<uint64_t> numberOfTrees{0};
+          return ++numberOfTrees;
+      }())
+{
+    size_t capacity = 1;
+    while (capacity < this->options.bufferCapacity)
+    {
+        capacity *= 2;
+    }
+    this->options.bufferCapacity = capacity;
+    this->options.maxBatch = std::max<size_t>(1, this->options.maxBatch);
+
+    applier = std::thread([this]() { runApplier(); });
+}
+
+// Applies everything already pushed before returning. Producers must have
+// stopped pushing by then.
+template <typename TKey, typename TData>
+WriteCombiningRBTree<TKey, TData>::~WriteCombiningRBTree()
+{
+    {
+        std::lock_guard<std::mutex> lock(applierMutex);
+        stopRequested = true;
+    }
+    applierWakeup.notify_one();
+    applier.join();
+
+    for (const std::shared_ptr<ProducerBuffer>& buffer : buffers)
+    {
+        buffer->treeDestroyed.store(true, std::memory_order_release);
+    }
+}
+
+// Errors of batched operations, such as a pop of an absent key, are reported
+// from the applier thread.
+template <typename TKey, typename TData>
+void WriteCombiningRBTree<TKey, TData>::setErrorHandler(void (*errorHandler)(const char* message))
+{
+    std::unique_lock<std::shared_mutex> lock(treeMutex);
+    tree.setErrorHandler(errorHandler);
+}
+
+
+template <typename TKey, typename TData>
+void WriteCombiningRBTree<TKey, TData>::add(const TKey& key, const TData& data)
+{
+    push(OperationType::Add, key, data);
+}
+
+template <typename TKey, typename TData>
+void WriteCombiningRBTree<TKey, TData>::pop(const TKey& key)
+{
+    push(OperationType::Pop, key, TData());
+}
+
+// Blocks until every operation the calling thread pushed before is applied.
+template <typename TKey, typename TData>
+void WriteCombiningRBTree<TKey, TData>::flush()
+{
+    std::unique_lock<std::mutex> lock(applierMutex);
+    uint64_t flushNumber = ++flushesRequested;
+    applierWakeup.notify_one();
+    flushDone.wait(lock, [&]() { return flushesDone >= flushNumber; });
+}
+
+template <typename TKey, typename TData>
+void WriteCombiningRBTree<TKey, TData>::push(OperationType type, const TKey& key, const TData& data)
+{
+    std::chrono::steady_clock::time_point pushTime;
+    if (options.visibilityLatencyHook)
+    {
+        pushTime = std::chrono::steady_clock::now();
+    }
+
+    ProducerBuffer* buffer = bufferOfThisThread();
+    size_t tail = buffer->tail.load(std::memory_order_relaxed);
+    while (tail - buffer->head.load(std::memory_order_acquire) == options.bufferCapacity)
+    {
+        wakeApplier();
+        std::this_thread::yield();
+    }
+
+    Operation& operation = buffer->slots[tail & buffer->mask];
+    operation.type = type;
+    operation.key = key;
+    operation.data = data;
+    operation.pushTime = pushTime;
+    buffer->tail.store(tail + 1, std::memory_order_release);
+
+    if ((tail + 1) % options.maxBatch == 0)
+    {
+        wakeApplier();
+    }
+}
+
+// Every thread gets one buffer per tree on its first push. Once the thread
+// exits, the applier drains its buffers and drops them. Buffers of destroyed
+// trees are dropped the next time the thread registers a new one, so a
+// thread holds buffers of live trees only, plus at most the ones destroyed
+// since.
+template <typename TKey, typename TData>
+typename WriteCombiningRBTree<TKey, TData>::ProducerBuffer* WriteCombiningRBTree<TKey, TData>::bufferOfThisThread()
+{
+    // Tree ids are never reused, so a stale lastTreeId never matches.
+    thread_local ThreadBuffers threadBuffers;
+
+    if (threadBuffers.lastTreeId != treeId)
+    {
+        auto entry = threadBuffers.buffers.find(treeId);
+        if (entry == threadBuffers.buffers.end())
+        {
+            for (auto other = threadBuffers.buffers.begin(); other != threadBuffers.buffers.end();)
+            {
+                if (other->second->treeDestroyed.load(std::memory_order_acquire))
+                    other = threadBuffers.buffers.erase(other);
+                else
+                    ++other;
+            }
+            entry = threadBuffers.buffers.emplace(treeId, registerBuffer()).first;
+        }
+        threadBuffers.lastTreeId = treeId;
+        threadBuffers.lastBuffer = entry->second.get();
+    }
+    return threadBuffers.lastBuffer;
+}
+
+template <typename TKey, typename TData>
+std::shared_ptr<typename WriteCombiningRBTree<TKey, TData>::ProducerBuffer> WriteCombiningRBTree<TKey, TData>::registerBuffer()
+{
+    std::lock_guard<std::mutex> lock(applierMutex);
+    buffers.push_back(std::make_shared<ProducerBuffer>(options.bufferCapacity));
+    return buffers.back();
+}
+
+// A wakeup that races with the applier going to sleep is lost; the applier
+// then wakes up after flushInterval instead.
+template <typename TKey, typename TData>
+void WriteCombiningRBTree<TKey, TData>::wakeApplier()
+{
+    if (!wakeRequested.exchange(true, std::memory_order_acq_rel))
+    {
+        applierWakeup.notify_one();
+    }
+}
+
+
+template <typename TKey, typename TData>
+std::list<TData> WriteCombiningRBTree<TKey, TData>::find(const TKey& key) const
+{
+    std::shared_lock<std::shared_mutex> lock(treeMutex);
+    return tree.find(key);
+}
+
+// Calls function(tree, version) under the shared lock, for reads that must
+// see one version across several lookups.
+template <typename TKey, typename TData>
+template <typename TFunction>
+void WriteCombiningRBTree<TKey, TData>::read(TFunction function) const
+{
+    std::shared_lock<std::shared_mutex> lock(treeMutex);
+    function(static_cast<const RBTree<TKey, TData>&>(tree), publishedVersion.load(std::memory_order_relaxed));
+}
+
+// Number of batches applied so far.
+template <typename TKey, typename TData>
+uint64_t WriteCombiningRBTree<TKey, TData>::version() const
+{
+    return publishedVersion.load(std::memory_order_acquire);
+}
+
+
+template <typename TKey, typename TData>
+void WriteCombiningRBTree<TKey, TData>::runApplier()
+{
+    std::vector<Operation> batch;
+    std::vector<BufferToDrain> buffersToDrain;
+
+    std::unique_lock<std::mutex> lock(applierMutex);
+    while (true)
+    {
+        applierWakeup.wait_for(lock, options.flushInterval, [&]()
+        {
+            return stopRequested || flushesRequested != flushesDone || wakeRequested.load(std::memory_order_acquire);
+        });
+        wakeRequested.store(false, std::memory_order_release);
+
+        // Everything pushed before these requests is in the buffers by now.
+        // Operations pushed later wait for the next round, so a round ends
+        // even if producers keep pushing.
+        bool stopping = stopRequested;
+        uint64_t flushesServed = flushesRequested;
+        removeExitedBuffers();
+        buffersToDrain.clear();
+        for (const std::shared_ptr<ProducerBuffer>& buffer : buffers)
+        {
+            buffersToDrain.push_back(BufferToDrain{buffer.get(), buffer->tail.load(std::memory_order_acquire)});
+        }
+        lock.unlock();
+
+        while (drainBuffers(buffersToDrain, batch))
+        {
+            applyBatch(batch);
+        }
+
+        lock.lock();
+        if (flushesDone != flushesServed)
+        {
+            flushesDone = flushesServed;
+            flushDone.notify_all();
+        }
+        if (stopping)
+        {
+            return;
+        }
+    }
+}
+
+// Drops buffers whose thread has exited once they are empty. Called with
+// applierMutex held.
+template <typename TKey, typename TData>
+void WriteCombiningRBTree<TKey, TData>::removeExitedBuffers()
+{
+    buffers.erase(std::remove_if(buffers.begin(), buffers.end(), [](const std::shared_ptr<ProducerBuffer>& buffer)
+    {
+        // The exit flag first: it makes the thread's last tail visible.
+        return buffer->producerExited.load(std::memory_order_acquire)
+            && buffer->head.load(std::memory_order_relaxed) == buffer->tail.load(std::memory_order_acquire);
+    }), buffers.end());
+}
+
+// Takes the next batch of at most maxBatch operations, a prefix of what is
+// left of every buffer up to its recorded tail. Returns false when nothing
+// was left.
+template <typename TKey, typename TData>
+bool WriteCombiningRBTree<TKey, TData>::drainBuffers(
+        const std::vector<BufferToDrain>& buffersToDrain,
+        std::vector<Operation>& batch) {
+
+    batch.clear();
+    for (const BufferToDrain& bufferToDrain : buffersToDrain)
+    {
+        ProducerBuffer* buffer = bufferToDrain.buffer;
+        size_t head = buffer->head.load(std::memory_order_relaxed);
+        size_t tail = std::min(bufferToDrain.tail, head + (options.maxBatch - batch.size()));
+        for (; head != tail; head++)
+        {
+            batch.push_back(std::move(buffer->slots[head & buffer->mask]));
+        }
+        buffer->head.store(tail, std::memory_order_release);
+
+        if (batch.size() == options.maxBatch)
+            break;
+    }
+    return !batch.empty();
+}
+
+// Sorted operations go in as runs of adjacent keys, so every insert is
+// hinted with the key before it. The whole batch is published at once.
+template <typename TKey, typename TData>
+void WriteCombiningRBTree<TKey, TData>::applyBatch(std::vector<Operation>& batch)
+{
+    std::stable_sort(batch.begin(), batch.end(), [this](const Operation& left, const Operation& right)
+    {
+        return comparatorStrategy->compare(left.key, right.key) < 0;
+    });
+
+    {
+        std::unique_lock<std::shared_mutex> lock(treeMutex);
+        typename RBTree<TKey, TData>::Iterator hint = tree.end();
+        for (const Operation& operation : batch)
+        {
+            if (operation.type == OperationType::Add)
+            {
+                hint = tree.insert(hint, operation.key, operation.data);
+            }
+            else
+            {
+                tree.pop(operation.key);
+                hint = tree.end();
+            }
+        }
+        publishedVersion.fetch_add(1, std::memory_order_release);
+    }
+
+    if (options.visibilityLatencyHook)
+    {
+        std::chrono::steady_clock::time_point visibleTime = std::chrono::steady_clock::now();
+        for (const Operation& operation : batch)
+        {
+            options.visibilityLatencyHook(visibleTime - operation.pushTime);
+        }
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstring>
+#include <string>
+
+// Command line parsing shared by the benchmark executables.
+
+// Reads an option given as name=value. Returns false, leaving value as it
+// was, when the argument is a different option.
+inline bool readOption(const char* argument, const char* name, std::string& value)
+{
+    size_t length = std::strlen(name);
+    if (std::strncmp(argument, name, length) != 0 || argument[length] != '=')
+        return false;
+    value = argument + length + 1;
+    return true;
+}
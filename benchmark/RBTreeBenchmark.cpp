@@ -0,0 +1,1105 @@
+// Benchmark suite for RBTree with std::map as the baseline.
+//
+// Every result is written as one JSON object with ns/op, allocations/op,
+// allocated bytes/op and live heap bytes per stored element, so runs of
+// different versions can be compared by a script.
+//
+//   rbtree_benchmark [--min-size=N] [--max-size=N] [--seed=N]
+//                    [--repetitions=N] [--filter=TEXT] [--output=FILE|-]
+//
+// Sizes are 1K, 10K, ... 100M limited to [min-size, max-size]; the default
+// maximum is 1M because 100M elements need tens of gigabytes of memory.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ExpiringRBTree.h"
+#include "RedBlackTree.h"
+#include "StringKey.h"
+#include "comparators/DefaultComparator.h"
+#include "Options.h"
+#include "Workload.h"
+
+// ---------------------------------------------------------------------------
+// Allocation accounting: every global allocation carries a small header with
+// its size, so frees can be subtracted from the live byte count.
+
+namespace
+{
+    struct AllocationCounters
+    {
+        uint64_t allocations = 0;
+        uint64_t allocatedBytes = 0;
+        int64_t liveBytes = 0;
+    };
+
+    AllocationCounters allocationCounters;
+
+    const size_t allocationHeaderSize = 16;
+
+    // Kept out of line: inlined into operator delete, the header arithmetic
+    // looks to the compiler like free() of a pointer into a new'ed object.
+    [[gnu::noinline]] void* countedAllocate(size_t size)
+    {
+        void* block = std::malloc(size + allocationHeaderSize);
+        if (block == nullptr)
+            return nullptr;
+
+        *static_cast<size_t*>(block) = size;
+        allocationCounters.allocations++;
+        allocationCounters.allocatedBytes += size;
+        allocationCounters.liveBytes += static_cast<int64_t>(size);
+        return static_cast<char*>(block) + allocationHeaderSize;
+    }
+
+    [[gnu::noinline]] void countedFree(void* pointer)
+    {
+        if (pointer == nullptr)
+            return;
+
+        void* block = static_cast<char*>(pointer) - allocationHeaderSize;
+        allocationCounters.liveBytes -= static_cast<int64_t>(*static_cast<size_t*>(block));
+        std::free(block);
+    }
+}
+
+void* operator new(size_t size)
+{
+    void* pointer = countedAllocate(size);
+    if (pointer == nullptr)
+        throw std::bad_alloc();
+    return pointer;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return countedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return countedAllocate(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    countedFree(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    countedFree(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    countedFree(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+    countedFree(pointer);
+}
+
+// ---------------------------------------------------------------------------
+// Containers under test. Each adapter exposes insert, find (returning the
+// number of values seen, so the work can't be optimised away), erase of a
+// whole key and eraseOne, which removes the oldest value of a key. Trees
+// also report their own memory accounting.
+
+class StdStringComparator : public ComparatorStrategy<std::string>
+{
+public:
+    int compare(const std::string& left, const std::string& right) const override
+    {
+        int result = left.compare(right);
+        return (result > 0) - (result < 0);
+    }
+};
+
+template <typename TKey, typename TComparator>
+class RBTreeContainer
+{
+private:
+    TComparator comparator;
+    RBTree<TKey, uint64_t> tree;
+    typename RBTree<TKey, uint64_t>::Iterator hint;
+
+public:
+    static const char* name()
+    {
+        return "RBTree";
+    }
+
+    RBTreeContainer() : tree(&comparator), hint(tree.end())
+    {
+    }
+
+    void insert(const TKey& key, uint64_t value)
+    {
+        tree.add(key, value);
+    }
+
+    // Uses the previously inserted key as the hint.
+    void insertHinted(const TKey& key, uint64_t value)
+    {
+        hint = tree.insert(hint, key, value);
+    }
+
+    void upsert(const TKey& key)
+    {
+        tree.upsert(key, [](uint64_t& value) { value++; });
+    }
+
+    uint64_t find(const TKey& key) const
+    {
+        return tree.count(key);
+    }
+
+    void erase(const TKey& key)
+    {
+        tree.pop(key);
+    }
+
+    void eraseOne(const TKey& key)
+    {
+        tree.popFirstValues(key, 1);
+    }
+
+    RBTreeStatistics getStatistics() const
+    {
+        return tree.getStatistics();
+    }
+
+    bool getMemoryUsage(RBTreeMemoryUsage& usage) const
+    {
+        usage = tree.memoryUsage();
+        return true;
+    }
+
+    void resetStatistics()
+    {
+        tree.resetStatistics();
+    }
+};
+
+template <typename TKey>
+class StdMapContainer
+{
+private:
+    std::map<TKey, uint64_t> map;
+    typename std::map<TKey, uint64_t>::iterator hint = map.end();
+
+public:
+    static const char* name()
+    {
+        return "std::map";
+    }
+
+    void insert(const TKey& key, uint64_t value)
+    {
+        map.emplace(key, value);
+    }
+
+    void insertHinted(const TKey& key, uint64_t value)
+    {
+        hint = map.emplace_hint(hint, key, value);
+    }
+
+    void upsert(const TKey& key)
+    {
+        map[key]++;
+    }
+
+    uint64_t find(const TKey& key) const
+    {
+        return map.find(key) != map.end() ? 1 : 0;
+    }
+
+    void erase(const TKey& key)
+    {
+        map.erase(key);
+    }
+
+    void eraseOne(const TKey& key)
+    {
+        map.erase(key);
+    }
+
+    RBTreeStatistics getStatistics() const
+    {
+        return RBTreeStatistics();
+    }
+
+    bool getMemoryUsage(RBTreeMemoryUsage&) const
+    {
+        return false;
+    }
+
+    void resetStatistics()
+    {
+    }
+};
+
+template <typename TKey>
+class StdMultimapContainer
+{
+private:
+    std::multimap<TKey, uint64_t> map;
+    typename std::multimap<TKey, uint64_t>::iterator hint = map.end();
+
+public:
+    static const char* name()
+    {
+        return "std::multimap";
+    }
+
+    void insert(const TKey& key, uint64_t value)
+    {
+        map.emplace(key, value);
+    }
+
+    void insertHinted(const TKey& key, uint64_t value)
+    {
+        hint = map.emplace_hint(hint, key, value);
+    }
+
+    void upsert(const TKey& key)
+    {
+        auto it = map.find(key);
+        if (it == map.end())
+            map.emplace(key, 1);
+        else
+            it->second++;
+    }
+
+    uint64_t find(const TKey& key) const
+    {
+        uint64_t values = 0;
+        auto range = map.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            values++;
+        }
+        return values;
+    }
+
+    void erase(const TKey& key)
+    {
+        map.erase(key);
+    }
+
+    void eraseOne(const TKey& key)
+    {
+        auto it = map.lower_bound(key);
+        if (it != map.end() && !(key < it->first))
+            map.erase(it);
+    }
+
+    RBTreeStatistics getStatistics() const
+    {
+        return RBTreeStatistics();
+    }
+
+    bool getMemoryUsage(RBTreeMemoryUsage&) const
+    {
+        return false;
+    }
+
+    void resetStatistics()
+    {
+    }
+};
+
+// Entries with deadlines, expired in sweeps. ExpiringRBTree pops them from its
+// deadline index; the baseline is what a plain RBTree needs: a full traversal
+// and a pop per expired key.
+
+using ExpiryTimePoint = ExpiringRBTree<uint64_t, uint64_t>::TimePoint;
+
+class ExpiringRBTreeContainer
+{
+private:
+    DefaultComparator<uint64_t> comparator;
+    ExpiringRBTree<uint64_t, uint64_t> tree;
+
+public:
+    static const char* name()
+    {
+        return "ExpiringRBTree";
+    }
+
+    ExpiringRBTreeContainer() : tree(&comparator)
+    {
+    }
+
+    void insert(uint64_t key, uint64_t value, ExpiryTimePoint deadline)
+    {
+        tree.add(key, value, deadline);
+    }
+
+    size_t expireUntil(ExpiryTimePoint now)
+    {
+        return tree.expireUntil(now);
+    }
+
+    RBTreeStatistics getStatistics() const
+    {
+        return RBTreeStatistics();
+    }
+
+    bool getMemoryUsage(RBTreeMemoryUsage&) const
+    {
+        return false;
+    }
+
+    void resetStatistics()
+    {
+    }
+};
+
+class ScanningExpiryContainer
+{
+private:
+    DefaultComparator<uint64_t> comparator;
+    RBTree<uint64_t, std::pair<uint64_t, ExpiryTimePoint>> tree;
+
+public:
+    static const char* name()
+    {
+        return "RBTree";
+    }
+
+    ScanningExpiryContainer() : tree(&comparator)
+    {
+    }
+
+    void insert(uint64_t key, uint64_t value, ExpiryTimePoint deadline)
+    {
+        tree.insertOrAssign(key, std::make_pair(value, deadline));
+    }
+
+    size_t expireUntil(ExpiryTimePoint now)
+    {
+        std::vector<uint64_t> expiredKeys;
+        for (auto entry = tree.begin(); entry != tree.end(); ++entry)
+        {
+            if (!(now < entry.values().front().second))
+                expiredKeys.push_back(entry.key());
+        }
+        for (uint64_t key : expiredKeys)
+        {
+            tree.pop(key);
+        }
+        return expiredKeys.size();
+    }
+
+    RBTreeStatistics getStatistics() const
+    {
+        return tree.getStatistics();
+    }
+
+    bool getMemoryUsage(RBTreeMemoryUsage& usage) const
+    {
+        usage = tree.memoryUsage();
+        return true;
+    }
+
+    void resetStatistics()
+    {
+        tree.resetStatistics();
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Measurement and reporting.
+
+struct BenchmarkOptions
+{
+    uint64_t minSize = 1000;
+    uint64_t maxSize = 1000000;
+    uint64_t seed = 42;
+    unsigned repetitions = 1;
+    std::string filter;
+    std::string output = "rbtree_benchmark.json";
+};
+
+struct BenchmarkResult
+{
+    std::string container;
+    std::string keyType;
+    std::string keySet;
+    std::string operation;
+    std::string distribution;
+    std::string multiplicity;
+    uint64_t size = 0;
+    uint64_t operations = 0;
+    double nanosecondsPerOperation = 0;
+    double allocationsPerOperation = 0;
+    double allocatedBytesPerOperation = 0;
+    double bytesPerElement = 0;
+    RBTreeStatistics treeStatistics;
+    bool hasMemoryUsage = false;
+    RBTreeMemoryUsage memoryUsage;
+};
+
+struct Measurement
+{
+    uint64_t nanoseconds;
+    uint64_t allocations;
+    uint64_t allocatedBytes;
+    RBTreeStatistics treeStatistics;
+    bool hasMemoryUsage = false;
+    RBTreeMemoryUsage memoryUsage;
+};
+
+volatile uint64_t benchmarkSink;
+
+template <typename TFunction>
+Measurement measure(TFunction function)
+{
+    AllocationCounters before = allocationCounters;
+    auto start = std::chrono::steady_clock::now();
+
+    benchmarkSink = function();
+
+    auto finish = std::chrono::steady_clock::now();
+    Measurement measurement = {};
+    measurement.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count();
+    measurement.allocations = allocationCounters.allocations - before.allocations;
+    measurement.allocatedBytes = allocationCounters.allocatedBytes - before.allocatedBytes;
+    return measurement;
+}
+
+class BenchmarkReport
+{
+private:
+    const BenchmarkOptions& options;
+    std::vector<BenchmarkResult> results;
+
+public:
+    explicit BenchmarkReport(const BenchmarkOptions& options) : options(options)
+    {
+    }
+
+    bool isSelected(const BenchmarkResult& result) const
+    {
+        return options.filter.empty() || nameOf(result).find(options.filter) != std::string::npos;
+    }
+
+    void add(BenchmarkResult result, const Measurement& measurement, double bytesPerElement)
+    {
+        double operations = result.operations ? static_cast<double>(result.operations) : 1.0;
+        result.nanosecondsPerOperation = measurement.nanoseconds / operations;
+        result.allocationsPerOperation = measurement.allocations / operations;
+        result.allocatedBytesPerOperation = measurement.allocatedBytes / operations;
+        result.bytesPerElement = bytesPerElement;
+        result.treeStatistics = measurement.treeStatistics;
+        result.hasMemoryUsage = measurement.hasMemoryUsage;
+        result.memoryUsage = measurement.memoryUsage;
+
+        std::fprintf(stderr, "%-60s %10.1f ns/op %8.2f allocs/op %8.1f B/elem\n",
+                nameOf(result).c_str(), result.nanosecondsPerOperation,
+                result.allocationsPerOperation, result.bytesPerElement);
+        results.push_back(result);
+    }
+
+    void write(std::ostream& out) const
+    {
+        out << "{\n";
+        out << "  \"benchmark\": \"rbtree\",\n";
+        out << "  \"format_version\": 1,\n";
+        out << "  \"configuration\": {\"min_size\": " << options.minSize
+            << ", \"max_size\": " << options.maxSize
+            << ", \"seed\": " << options.seed
+            << ", \"repetitions\": " << options.repetitions << "},\n";
+        out << "  \"results\": [";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const BenchmarkResult& result = results[i];
+            out << (i ? ",\n" : "\n");
+            out << "    {\"name\": \"" << nameOf(result) << "\""
+                << ", \"container\": \"" << result.container << "\""
+                << ", \"key_type\": \"" << result.keyType << "\""
+                << ", \"key_set\": \"" << result.keySet << "\""
+                << ", \"operation\": \"" << result.operation << "\""
+                << ", \"distribution\": \"" << result.distribution << "\""
+                << ", \"multiplicity\": \"" << result.multiplicity << "\""
+                << ", \"size\": " << result.size
+                << ", \"operations\": " << result.operations
+                << ", \"ns_per_op\": " << result.nanosecondsPerOperation
+                << ", \"allocations_per_op\": " << result.allocationsPerOperation
+                << ", \"allocated_bytes_per_op\": " << result.allocatedBytesPerOperation
+                << ", \"memory_bytes_per_element\": " << result.bytesPerElement;
+            if (result.treeStatistics.enabled)
+            {
+                writeTreeStatistics(out, result.treeStatistics, result.operations);
+            }
+            if (result.hasMemoryUsage)
+            {
+                writeMemoryUsage(out, result.memoryUsage);
+            }
+            out << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+    // Only present when the benchmark is built with RBTREE_ENABLE_STATISTICS.
+    static void writeTreeStatistics(std::ostream& out, const RBTreeStatistics& statistics, uint64_t operations)
+    {
+        double perOperation = 1.0 / (operations ? operations : 1);
+        double depthSum = 0;
+        for (size_t depth = 0; depth < RBTreeStatistics::depthHistogramSize; depth++)
+        {
+            depthSum += double(depth) * statistics.searchDepthHistogram[depth];
+        }
+
+        out << ", \"tree_statistics\": {"
+            << "\"comparisons_per_op\": " << statistics.comparisons * perOperation
+            << ", \"single_rotations_per_op\": " << statistics.singleRotations * perOperation
+            << ", \"double_rotations_per_op\": " << statistics.doubleRotations * perOperation
+            << ", \"recolorings_per_op\": " << statistics.recolorings * perOperation
+            << ", \"node_allocations_per_op\": " << statistics.nodeAllocations * perOperation
+            << ", \"node_deallocations_per_op\": " << statistics.nodeDeallocations * perOperation
+            << ", \"chunk_allocations_per_op\": " << statistics.chunkAllocations * perOperation
+            << ", \"chunk_deallocations_per_op\": " << statistics.chunkDeallocations * perOperation
+            << ", \"mean_search_depth\": " << (statistics.searches ? depthSum / statistics.searches : 0.0)
+            << "}";
+    }
+
+    // The tree's own accounting of what it holds after the measured run.
+    static void writeMemoryUsage(std::ostream& out, const RBTreeMemoryUsage& usage)
+    {
+        out << ", \"memory_usage\": {"
+            << "\"node_bytes\": " << usage.nodeBytes
+            << ", \"value_bytes\": " << usage.valueBytes
+            << ", \"slack_bytes\": " << usage.slackBytes
+            << ", \"user_bytes\": " << usage.userBytes
+            << ", \"total_bytes\": " << usage.totalBytes
+            << "}";
+    }
+
+    static std::string nameOf(const BenchmarkResult& result)
+    {
+        return result.container + "/" + result.keyType + "/" + result.keySet + "/" + result.operation + "/" +
+               result.distribution + "/" + result.multiplicity + "/" + std::to_string(result.size);
+    }
+};
+
+// Runs one measurement `repetitions` times on a fresh container each time and
+// keeps the fastest run. prepare fills the container outside of the timing.
+template <typename TContainer, typename TPrepare, typename TRun>
+Measurement measureBest(unsigned repetitions, TPrepare prepare, TRun run)
+{
+    Measurement best = {};
+    best.nanoseconds = UINT64_MAX;
+    for (unsigned i = 0; i < repetitions; i++)
+    {
+        TContainer container;
+        prepare(container);
+        container.resetStatistics();
+        Measurement measurement = measure([&]() { return run(container); });
+        measurement.treeStatistics = container.getStatistics();
+        measurement.hasMemoryUsage = container.getMemoryUsage(measurement.memoryUsage);
+        if (measurement.nanoseconds < best.nanoseconds)
+            best = measurement;
+    }
+    return best;
+}
+
+// ---------------------------------------------------------------------------
+// Integer key workloads.
+
+enum class OperationType
+{
+    Find,
+    Insert,
+    Erase
+};
+
+struct Operation
+{
+    OperationType type;
+    uint64_t key;
+};
+
+// 50% finds, 25% inserts and 25% erases. The trace is generated against a
+// model of the live keys, so finds and erases always hit.
+std::vector<Operation> makeMixedTrace(
+        const std::vector<uint64_t>& insertedKeys,
+        KeyDistribution distribution,
+        KeyMultiplicity multiplicity,
+        uint64_t operations,
+        uint64_t seed) {
+
+    std::vector<uint64_t> liveKeys = distinctKeysInInsertOrder(insertedKeys);
+    std::unordered_map<uint64_t, size_t> positions;
+    for (size_t i = 0; i < liveKeys.size(); i++)
+    {
+        positions[liveKeys[i]] = i;
+    }
+
+    KeyGenerator newKeys(distribution, multiplicity, insertedKeys.size(), seed + 1);
+    for (size_t i = 0; i < insertedKeys.size(); i++)
+    {
+        newKeys.next();
+    }
+    IndexPicker picker(distribution, liveKeys.size(), seed + 2);
+    SplitMix64 random(seed + 3);
+
+    std::vector<Operation> trace;
+    trace.reserve(operations);
+    for (uint64_t i = 0; i < operations; i++)
+    {
+        uint64_t dice = random.nextBelow(4);
+        if (dice >= 2 || liveKeys.empty())
+        {
+            uint64_t key = newKeys.next();
+            if (positions.emplace(key, liveKeys.size()).second)
+                liveKeys.push_back(key);
+            trace.push_back({OperationType::Insert, key});
+            continue;
+        }
+
+        size_t position = picker.next(liveKeys.size());
+        uint64_t key = liveKeys[position];
+        if (dice == 0)
+        {
+            trace.push_back({OperationType::Find, key});
+            continue;
+        }
+
+        trace.push_back({OperationType::Erase, key});
+        positions[liveKeys.back()] = position;
+        liveKeys[position] = liveKeys.back();
+        liveKeys.pop_back();
+        positions.erase(key);
+    }
+    return trace;
+}
+
+template <typename TContainer>
+void runIntegerBenchmarks(
+        BenchmarkReport& report,
+        const BenchmarkOptions& options,
+        KeyDistribution distribution,
+        KeyMultiplicity multiplicity,
+        uint64_t size) {
+
+    std::vector<uint64_t> keys = makeKeys(distribution, multiplicity, size, options.seed);
+    std::vector<uint64_t> distinctKeys = distinctKeysInInsertOrder(keys);
+
+    BenchmarkResult result;
+    result.container = TContainer::name();
+    result.keyType = "uint64";
+    result.keySet = "integer";
+    result.distribution = toString(distribution);
+    result.multiplicity = toString(multiplicity);
+    result.size = size;
+
+    auto fill = [&](TContainer& container) {
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            container.insert(keys[i], i);
+        }
+        return keys.size();
+    };
+    auto nothing = [](TContainer&) {};
+
+    result.operation = "insert";
+    result.operations = keys.size();
+    if (report.isSelected(result))
+    {
+        int64_t liveBefore = allocationCounters.liveBytes;
+        double bytesPerElement = 0;
+        Measurement measurement = measureBest<TContainer>(options.repetitions, nothing, [&](TContainer& container) {
+            uint64_t inserted = fill(container);
+            bytesPerElement = double(allocationCounters.liveBytes - liveBefore) / keys.size();
+            return inserted;
+        });
+        report.add(result, measurement, bytesPerElement);
+    }
+
+    // Each insert is hinted with the previous one, which is adjacent for
+    // ascending keys.
+    result.operation = "insert_hint";
+    result.operations = keys.size();
+    if (report.isSelected(result))
+    {
+        Measurement measurement = measureBest<TContainer>(options.repetitions, nothing, [&](TContainer& container) {
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                container.insertHinted(keys[i], i);
+            }
+            return keys.size();
+        });
+        report.add(result, measurement, 0);
+    }
+
+    // Update the value of a key that exists, insert it otherwise.
+    result.operation = "upsert";
+    result.operations = keys.size();
+    if (report.isSelected(result))
+    {
+        Measurement measurement = measureBest<TContainer>(options.repetitions, nothing, [&](TContainer& container) {
+            for (uint64_t key : keys)
+            {
+                container.upsert(key);
+            }
+            return keys.size();
+        });
+        report.add(result, measurement, 0);
+    }
+
+    result.operation = "find";
+    result.operations = keys.size();
+    if (report.isSelected(result))
+    {
+        std::vector<uint64_t> lookups(keys.size());
+        IndexPicker picker(distribution, keys.size(), options.seed + 7);
+        for (uint64_t& key : lookups)
+        {
+            key = keys[picker.next(keys.size())];
+        }
+        Measurement measurement = measureBest<TContainer>(options.repetitions, fill, [&](TContainer& container) {
+            uint64_t values = 0;
+            for (uint64_t key : lookups)
+            {
+                values += container.find(key);
+            }
+            return values;
+        });
+        report.add(result, measurement, 0);
+    }
+
+    result.operation = "erase";
+    result.operations = distinctKeys.size();
+    if (report.isSelected(result))
+    {
+        Measurement measurement = measureBest<TContainer>(options.repetitions, fill, [&](TContainer& container) {
+            for (uint64_t key : distinctKeys)
+            {
+                container.erase(key);
+            }
+            return distinctKeys.size();
+        });
+        report.add(result, measurement, 0);
+    }
+
+    // Drain the values one at a time in insertion order, as a queue per key.
+    result.operation = "erase_one";
+    result.operations = keys.size();
+    if (report.isSelected(result))
+    {
+        Measurement measurement = measureBest<TContainer>(options.repetitions, fill, [&](TContainer& container) {
+            for (uint64_t key : keys)
+            {
+                container.eraseOne(key);
+            }
+            return keys.size();
+        });
+        report.add(result, measurement, 0);
+    }
+
+    result.operation = "erase_miss";
+    result.operations = keys.size();
+    if (report.isSelected(result))
+    {
+        std::vector<uint64_t> missingKeys = makeMissingKeys(keys, keys.size(), options.seed + 13);
+        Measurement measurement = measureBest<TContainer>(options.repetitions, fill, [&](TContainer& container) {
+            for (uint64_t key : missingKeys)
+            {
+                container.erase(key);
+            }
+            return missingKeys.size();
+        });
+        report.add(result, measurement, 0);
+    }
+
+    result.operation = "mixed";
+    result.operations = keys.size();
+    if (report.isSelected(result))
+    {
+        std::vector<Operation> trace = makeMixedTrace(keys, distribution, multiplicity, keys.size(), options.seed);
+        Measurement measurement = measureBest<TContainer>(options.repetitions, fill, [&](TContainer& container) {
+            uint64_t values = 0;
+            for (size_t i = 0; i < trace.size(); i++)
+            {
+                const Operation& operation = trace[i];
+                if (operation.type == OperationType::Find)
+                    values += container.find(operation.key);
+                else if (operation.type == OperationType::Insert)
+                    container.insert(operation.key, i);
+                else
+                    container.erase(operation.key);
+            }
+            return values;
+        });
+        report.add(result, measurement, 0);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// String key workloads: URL-like keys sharing a long prefix, and short keys
+// that StringKey stores without a heap allocation.
+
+enum class StringKeySet
+{
+    Url,
+    Short
+};
+
+std::string makeStringKey(StringKeySet keySet, uint64_t index)
+{
+    uint64_t hash = scrambleKey(index);
+    char buffer[128];
+    if (keySet == StringKeySet::Url)
+    {
+        std::snprintf(buffer, sizeof(buffer), "https://api.example.com/v1/tenants/%02x/users/%06x/orders/%08x",
+                unsigned(hash & 0xFF), unsigned((hash >> 8) & 0xFFFFFF), unsigned(hash >> 32));
+    }
+    else
+    {
+        std::snprintf(buffer, sizeof(buffer), "user:%016llx", static_cast<unsigned long long>(hash));
+    }
+    return buffer;
+}
+
+template <typename TContainer, typename TKey>
+void runStringBenchmarks(
+        BenchmarkReport& report,
+        const BenchmarkOptions& options,
+        const char* keyType,
+        StringKeySet keySet,
+        uint64_t size) {
+
+    std::vector<TKey> keys;
+    keys.reserve(size);
+    for (uint64_t i = 0; i < size; i++)
+    {
+        keys.push_back(TKey(makeStringKey(keySet, i)));
+    }
+
+    std::vector<size_t> lookups(size);
+    IndexPicker picker(KeyDistribution::Random, size, options.seed + 11);
+    for (size_t& index : lookups)
+    {
+        index = picker.next(size);
+    }
+
+    BenchmarkResult result;
+    result.container = TContainer::name();
+    result.keyType = keyType;
+    result.keySet = keySet == StringKeySet::Url ? "url" : "short";
+    result.distribution = toString(KeyDistribution::Random);
+    result.multiplicity = toString(KeyMultiplicity::Unique);
+    result.size = size;
+    result.operations = size;
+
+    auto fill = [&](TContainer& container) {
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            container.insert(keys[i], i);
+        }
+        return keys.size();
+    };
+    auto nothing = [](TContainer&) {};
+
+    result.operation = "insert";
+    if (report.isSelected(result))
+    {
+        int64_t liveBefore = allocationCounters.liveBytes;
+        double bytesPerElement = 0;
+        Measurement measurement = measureBest<TContainer>(options.repetitions, nothing, [&](TContainer& container) {
+            uint64_t inserted = fill(container);
+            bytesPerElement = double(allocationCounters.liveBytes - liveBefore) / keys.size();
+            return inserted;
+        });
+        report.add(result, measurement, bytesPerElement);
+    }
+
+    result.operation = "find";
+    if (report.isSelected(result))
+    {
+        Measurement measurement = measureBest<TContainer>(options.repetitions, fill, [&](TContainer& container) {
+            uint64_t values = 0;
+            for (size_t index : lookups)
+            {
+                values += container.find(keys[index]);
+            }
+            return values;
+        });
+        report.add(result, measurement, 0);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Expiry: unique random keys with distinct deadlines in random order, expired
+// in expirySweeps equal steps of time.
+
+const uint64_t expirySweeps = 100;
+
+template <typename TContainer>
+void runExpiryBenchmarks(BenchmarkReport& report, const BenchmarkOptions& options, uint64_t size)
+{
+    std::vector<uint64_t> keys = makeKeys(KeyDistribution::Random, KeyMultiplicity::Unique, size, options.seed);
+    std::vector<uint64_t> deadlines(size);
+    for (uint64_t i = 0; i < size; i++)
+    {
+        deadlines[i] = scrambleKey(i ^ options.seed) % size;
+    }
+
+    BenchmarkResult result;
+    result.container = TContainer::name();
+    result.keyType = "uint64";
+    result.keySet = "ttl";
+    result.distribution = toString(KeyDistribution::Random);
+    result.multiplicity = toString(KeyMultiplicity::Unique);
+    result.size = size;
+    result.operations = size;
+
+    auto fill = [&](TContainer& container) {
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            container.insert(keys[i], i, ExpiryTimePoint(std::chrono::seconds(deadlines[i])));
+        }
+        return keys.size();
+    };
+    auto nothing = [](TContainer&) {};
+
+    result.operation = "insert";
+    if (report.isSelected(result))
+    {
+        int64_t liveBefore = allocationCounters.liveBytes;
+        double bytesPerElement = 0;
+        Measurement measurement = measureBest<TContainer>(options.repetitions, nothing, [&](TContainer& container) {
+            uint64_t inserted = fill(container);
+            bytesPerElement = double(allocationCounters.liveBytes - liveBefore) / keys.size();
+            return inserted;
+        });
+        report.add(result, measurement, bytesPerElement);
+    }
+
+    result.operation = "expire";
+    if (report.isSelected(result))
+    {
+        uint64_t step = std::max<uint64_t>(1, size / expirySweeps);
+        Measurement measurement = measureBest<TContainer>(options.repetitions, fill, [&](TContainer& container) {
+            uint64_t expired = 0;
+            for (uint64_t now = 0; now < size + step; now += step)
+            {
+                expired += container.expireUntil(ExpiryTimePoint(std::chrono::seconds(now)));
+            }
+            return expired;
+        });
+        report.add(result, measurement, 0);
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+bool parseOptions(int argc, char** argv, BenchmarkOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string value;
+        if (readOption(argv[i], "--min-size", value))
+            options.minSize = std::strtoull(value.c_str(), nullptr, 10);
+        else if (readOption(argv[i], "--max-size", value))
+            options.maxSize = std::strtoull(value.c_str(), nullptr, 10);
+        else if (readOption(argv[i], "--seed", value))
+            options.seed = std::strtoull(value.c_str(), nullptr, 10);
+        else if (readOption(argv[i], "--repetitions", value))
+            options.repetitions = std::max(1u, unsigned(std::strtoul(value.c_str(), nullptr, 10)));
+        else if (readOption(argv[i], "--filter", value))
+            options.filter = value;
+        else if (readOption(argv[i], "--output", value))
+            options.output = value;
+        else
+        {
+            std::cerr << "Unknown option " << argv[i] << '\n'
+                      << "Usage: " << argv[0]
+                      << " [--min-size=N] [--max-size=N] [--seed=N] [--repetitions=N]"
+                         " [--filter=TEXT] [--output=FILE|-]\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    if (!parseOptions(argc, argv, options))
+        return 1;
+
+    BenchmarkReport report(options);
+    const KeyDistribution distributions[] = {KeyDistribution::Sequential, KeyDistribution::Random, KeyDistribution::Zipfian};
+    const KeyMultiplicity multiplicities[] = {KeyMultiplicity::Unique, KeyMultiplicity::Duplicates};
+
+    for (uint64_t size = 1000; size <= 100000000; size *= 10)
+    {
+        if (size < options.minSize || size > options.maxSize)
+            continue;
+
+        for (KeyDistribution distribution : distributions)
+        {
+            for (KeyMultiplicity multiplicity : multiplicities)
+            {
+                runIntegerBenchmarks<RBTreeContainer<uint64_t, DefaultComparator<uint64_t>>>(
+                        report, options, distribution, multiplicity, size);
+
+                // std::map can't hold repeated keys, so workloads that repeat
+                // keys are compared against std::multimap instead.
+                bool keysRepeat = multiplicity == KeyMultiplicity::Duplicates || distribution == KeyDistribution::Zipfian;
+                if (keysRepeat)
+                    runIntegerBenchmarks<StdMultimapContainer<uint64_t>>(report, options, distribution, multiplicity, size);
+                else
+                    runIntegerBenchmarks<StdMapContainer<uint64_t>>(report, options, distribution, multiplicity, size);
+            }
+        }
+
+        for (StringKeySet keySet : {StringKeySet::Url, StringKeySet::Short})
+        {
+            runStringBenchmarks<RBTreeContainer<std::string, StdStringComparator>, std::string>(
+                    report, options, "std::string", keySet, size);
+            runStringBenchmarks<RBTreeContainer<StringKey, StringKeyComparator>, StringKey>(
+                    report, options, "StringKey", keySet, size);
+            runStringBenchmarks<StdMapContainer<std::string>, std::string>(
+                    report, options, "std::string", keySet, size);
+        }
+
+        runExpiryBenchmarks<ExpiringRBTreeContainer>(report, options, size);
+        runExpiryBenchmarks<ScanningExpiryContainer>(report, options, size);
+    }
+
+    if (options.output == "-")
+    {
+        report.write(std::cout);
+    }
+    else
+    {
+        std::ofstream out(options.output);
+        report.write(out);
+        if (!out)
+        {
+            std::cerr << "Can't write " << options.output << '\n';
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,571 @@
+// Differential fuzzer for RBTree. Replays operation traces against RBTree and
+// std::multimap, compares the result of every operation and runs validate()
+// as it goes. The same replay without the checks times a trace, e.g. one
+// captured in production.
+//
+//   rbtree_fuzzer [--seed=N] [--iterations=N] [--operations=N]
+//                 [--validate-every=N] [--failure-output=FILE]
+//   rbtree_fuzzer --replay=FILE [--validate-every=N]
+//   rbtree_fuzzer --replay=FILE --benchmark [--repetitions=N] [--output=FILE|-]
+//
+// Iteration i generates its trace from seed + i. The trace of a failing
+// iteration, up to the failing operation, is written to --failure-output so
+// it can be replayed with --replay.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "RedBlackTree.h"
+#include "comparators/DefaultComparator.h"
+#include "Options.h"
+#include "Trace.h"
+
+struct FuzzerOptions
+{
+    uint64_t seed = 1;
+    uint64_t iterations = 100;
+    uint64_t operations = 10000;
+    uint64_t validateEvery = 1;
+    std::string failureOutput = "rbtree_fuzzer_failure.trace";
+    std::string replay;
+    bool benchmark = false;
+    unsigned repetitions = 3;
+    std::string output = "-";
+};
+
+const char* lastTreeError = nullptr;
+
+void rememberTreeError(const char* message)
+{
+    lastTreeError = message;
+}
+
+// Applies operations to an RBTree and to std::multimap, the model, and
+// compares their answers.
+class DifferentialReplay
+{
+private:
+    DefaultComparator<uint64_t> comparator;
+    RBTree<uint64_t, uint64_t> tree;
+    std::multimap<uint64_t, uint64_t> model;
+    RBTree<uint64_t, uint64_t>::Iterator hint;
+    uint64_t applied = 0;
+
+public:
+    DifferentialReplay() : tree(&comparator), hint(tree.end())
+    {
+        tree.setErrorHandler(rememberTreeError);
+    }
+
+    // Returns false and describes the difference when the tree disagrees.
+    bool apply(const TraceOperation& operation, std::string& mismatch)
+    {
+        uint64_t key = operation.key;
+        auto range = model.equal_range(key);
+        size_t modelCount = model.count(key);
+        applied++;
+
+        switch (operation.type)
+        {
+        case TraceOperationType::Insert:
+            // About half of the inserts are hinted with the iterator of the
+            // previous insert, or end(). Other changes invalidate the hint.
+            if ((key ^ applied) % 2)
+            {
+                hint = tree.end();
+                if (tree.add(key, operation.value) != (modelCount == 0))
+                    return fail(mismatch, "add() reported the wrong novelty");
+            }
+            else
+            {
+                hint = tree.insert(hint, key, operation.value);
+                if (hint == tree.end() || hint.key() != key)
+                    return fail(mismatch, "insert() returned the wrong iterator");
+            }
+            model.emplace_hint(range.second, key, operation.value);
+            return true;
+
+        case TraceOperationType::Erase:
+            hint = tree.end();
+            if (tree.pop(key) != modelCount)
+                return fail(mismatch, "pop() removed the wrong number of values");
+            model.erase(range.first, range.second);
+            return true;
+
+        case TraceOperationType::EraseOne:
+            hint = tree.end();
+            if (tree.popFirstValues(key, 1) != (modelCount ? 1u : 0u))
+                return fail(mismatch, "popFirstValues() removed the wrong number of values");
+            if (modelCount)
+                model.erase(range.first);
+            return true;
+
+        case TraceOperationType::EraseValue:
+        {
+            hint = tree.end();
+            auto value = range.first;
+            while (value != range.second && value->second != operation.value)
+                ++value;
+            if (tree.popValue(key, operation.value) != (value != range.second))
+                return fail(mismatch, "popValue() disagrees about the value");
+            if (value != range.second)
+                model.erase(value);
+            return true;
+        }
+
+        case TraceOperationType::Assign:
+            hint = tree.end();
+            if (tree.insertOrAssign(key, operation.value) != (modelCount == 0))
+                return fail(mismatch, "insertOrAssign() reported the wrong novelty");
+            model.erase(range.first, range.second);
+            model.emplace(key, operation.value);
+            return true;
+
+        case TraceOperationType::Upsert:
+        {
+            hint = tree.end();
+            uint64_t addend = operation.value;
+            if (tree.upsert(key, [addend](uint64_t& value) { value += addend; }) != (modelCount == 0))
+                return fail(mismatch, "upsert() reported the wrong novelty");
+            auto first = modelCount ? range.first : model.emplace(key, 0);
+            first->second += addend;
+            return true;
+        }
+
+        case TraceOperationType::Update:
+        {
+            hint = tree.end();
+            uint64_t addend = operation.value;
+            if (tree.update(key, [addend](uint64_t& value) { value += addend; }) != (modelCount != 0))
+                return fail(mismatch, "update() disagrees about the key");
+            if (modelCount)
+                range.first->second += addend;
+            return true;
+        }
+
+        case TraceOperationType::LowerBound:
+        {
+            auto node = tree.lowerBound(key);
+            auto modelNode = model.lower_bound(key);
+            if (!sameNode(node, modelNode))
+                return fail(mismatch, "lowerBound() returned the wrong node");
+            if (model.empty())
+                return true;
+            --node;
+            if (modelNode == model.begin())
+                modelNode = model.end();
+            else
+                modelNode = model.lower_bound(std::prev(modelNode)->first);
+            if (!sameNode(node, modelNode))
+                return fail(mismatch, "operator--() went to the wrong node");
+            return true;
+        }
+
+        case TraceOperationType::Copy:
+        {
+            hint = tree.end();
+            RBTree<uint64_t, uint64_t> copy(tree);
+            tree = copy;
+            return true;
+        }
+
+        case TraceOperationType::Move:
+        {
+            hint = tree.end();
+            RBTree<uint64_t, uint64_t> moved(std::move(tree));
+            if (tree.size() != 0 || tree.begin() != tree.end())
+                return fail(mismatch, "moving left values behind");
+            tree = std::move(moved);
+            return true;
+        }
+
+        case TraceOperationType::Clear:
+            hint = tree.end();
+            tree.clear(true);
+            model.clear();
+            if (tree.size() != 0 || tree.begin() != tree.end())
+                return fail(mismatch, "clear() left values behind");
+            return true;
+
+        default:
+        {
+            std::list<uint64_t> values = tree.find(key);
+            std::list<uint64_t> modelValues;
+            for (auto value = range.first; value != range.second; ++value)
+                modelValues.push_back(value->second);
+            if (values != modelValues)
+                return fail(mismatch, "find() returned different values");
+            if (tree.count(key) != modelCount)
+                return fail(mismatch, "count() is wrong");
+            return true;
+        }
+        }
+    }
+
+    bool validate(std::string& mismatch)
+    {
+        lastTreeError = nullptr;
+        if (!tree.validate())
+            return fail(mismatch, lastTreeError ? lastTreeError : "validate() failed");
+        if (tree.size() != model.size())
+            return fail(mismatch, "size() differs from the model");
+        return true;
+    }
+
+    // Walks both containers in order.
+    bool compareAll(std::string& mismatch)
+    {
+        auto value = model.begin();
+        for (auto node = tree.begin(); node != tree.end(); ++node)
+        {
+            for (uint64_t nodeValue : node.values())
+            {
+                if (value == model.end() || value->first != node.key() || value->second != nodeValue)
+                    return fail(mismatch, "in-order contents differ from the model");
+                ++value;
+            }
+        }
+        if (value != model.end())
+            return fail(mismatch, "the model has more values than the tree");
+        return true;
+    }
+
+private:
+    // Whether node holds the key and values of the model's run starting at
+    // modelNode; end() matches end().
+    bool sameNode(const RBTree<uint64_t, uint64_t>::Iterator& node, std::multimap<uint64_t, uint64_t>::iterator modelNode) const
+    {
+        if (node == tree.end() || modelNode == model.end())
+            return node == tree.end() && modelNode == model.end();
+        if (node.key() != modelNode->first)
+            return false;
+        for (uint64_t value : node.values())
+        {
+            if (modelNode == model.end() || modelNode->first != node.key() || modelNode->second != value)
+                return false;
+            ++modelNode;
+        }
+        return modelNode == model.end() || modelNode->first != node.key();
+    }
+
+    static bool fail(std::string& mismatch, const char* message)
+    {
+        mismatch = message;
+        return false;
+    }
+};
+
+// Returns the index of the operation that failed, or trace.size().
+size_t replayChecked(const std::vector<TraceOperation>& trace, uint64_t validateEvery, std::string& mismatch)
+{
+    DifferentialReplay replay;
+    for (size_t i = 0; i < trace.size(); i++)
+    {
+        if (!replay.apply(trace[i], mismatch))
+            return i;
+        if (validateEvery && (i + 1) % validateEvery == 0 && !replay.validate(mismatch))
+            return i;
+    }
+    if (!replay.validate(mismatch) || !replay.compareAll(mismatch))
+        return trace.empty() ? 0 : trace.size() - 1;
+    return trace.size();
+}
+
+int runFuzzer(const FuzzerOptions& options)
+{
+    const KeyDistribution distributions[] = {KeyDistribution::Sequential, KeyDistribution::Random, KeyDistribution::Zipfian};
+    const uint64_t keySpaces[] = {16, 256, 4096, 1 << 20};
+
+    for (uint64_t iteration = 0; iteration < options.iterations; iteration++)
+    {
+        uint64_t seed = options.seed + iteration;
+        SplitMix64 random(seed);
+        KeyDistribution distribution = distributions[random.nextBelow(3)];
+        uint64_t keySpace = keySpaces[random.nextBelow(4)];
+        TraceMix mix;
+        mix.insert = 20 + unsigned(random.nextBelow(50));
+        mix.erase = unsigned(random.nextBelow(15));
+        mix.eraseOne = unsigned(random.nextBelow(15));
+        mix.eraseValue = unsigned(random.nextBelow(15));
+        mix.assign = unsigned(random.nextBelow(10));
+        mix.upsert = unsigned(random.nextBelow(10));
+        mix.update = unsigned(random.nextBelow(10));
+        mix.lowerBound = unsigned(random.nextBelow(10));
+        mix.copy = unsigned(random.nextBelow(2));
+        mix.move = unsigned(random.nextBelow(2));
+        mix.clear = unsigned(random.nextBelow(2));
+
+        std::vector<TraceOperation> trace = makeTrace(distribution, mix, keySpace, options.operations, seed);
+        std::string mismatch;
+        size_t failed = replayChecked(trace, options.validateEvery, mismatch);
+        if (failed == trace.size())
+            continue;
+
+        const TraceOperation& operation = trace[failed];
+        std::cerr << "Iteration " << iteration << " (seed " << seed << "), operation " << failed << " ("
+                  << toString(operation.type) << ' ' << operation.key << "): " << mismatch << '\n';
+
+        trace.resize(failed + 1);
+        std::ofstream out(options.failureOutput);
+        writeTrace(out, trace);
+        if (out)
+            std::cerr << "Trace written to " << options.failureOutput << '\n';
+        return 1;
+    }
+
+    std::cerr << options.iterations << " iterations of " << options.operations << " operations passed\n";
+    return 0;
+}
+
+volatile uint64_t replaySink;
+
+uint64_t replayOn(RBTree<uint64_t, uint64_t>& tree, const std::vector<TraceOperation>& trace)
+{
+    uint64_t seen = 0;
+    for (const TraceOperation& operation : trace)
+    {
+        switch (operation.type)
+        {
+        case TraceOperationType::Insert:
+            tree.add(operation.key, operation.value);
+            break;
+        case TraceOperationType::Erase:
+            seen += tree.pop(operation.key);
+            break;
+        case TraceOperationType::EraseOne:
+            seen += tree.popFirstValues(operation.key, 1);
+            break;
+        case TraceOperationType::EraseValue:
+            seen += tree.popValue(operation.key, operation.value);
+            break;
+        case TraceOperationType::Assign:
+            seen += tree.insertOrAssign(operation.key, operation.value);
+            break;
+        case TraceOperationType::Upsert:
+        {
+            uint64_t addend = operation.value;
+            seen += tree.upsert(operation.key, [addend](uint64_t& value) { value += addend; });
+            break;
+        }
+        case TraceOperationType::Update:
+        {
+            uint64_t addend = operation.value;
+            seen += tree.update(operation.key, [addend](uint64_t& value) { value += addend; });
+            break;
+        }
+        case TraceOperationType::LowerBound:
+        {
+            auto node = tree.lowerBound(operation.key);
+            seen += node == tree.end() ? 0 : node.key();
+            break;
+        }
+        case TraceOperationType::Copy:
+        {
+            RBTree<uint64_t, uint64_t> copy(tree);
+            tree = copy;
+            break;
+        }
+        case TraceOperationType::Move:
+        {
+            RBTree<uint64_t, uint64_t> moved(std::move(tree));
+            tree = std::move(moved);
+            break;
+        }
+        case TraceOperationType::Clear:
+            tree.clear(true);
+            break;
+        default:
+        {
+            auto node = tree.findIterator(operation.key);
+            seen += node == tree.end() ? 0 : node.values().size();
+            break;
+        }
+        }
+    }
+    return seen;
+}
+
+uint64_t replayOn(std::multimap<uint64_t, uint64_t>& map, const std::vector<TraceOperation>& trace)
+{
+    uint64_t seen = 0;
+    for (const TraceOperation& operation : trace)
+    {
+        auto range = map.equal_range(operation.key);
+        switch (operation.type)
+        {
+        case TraceOperationType::Insert:
+            map.emplace_hint(range.second, operation.key, operation.value);
+            break;
+        case TraceOperationType::Erase:
+            seen += map.erase(operation.key);
+            break;
+        case TraceOperationType::EraseOne:
+            if (range.first != range.second)
+            {
+                map.erase(range.first);
+                seen++;
+            }
+            break;
+        case TraceOperationType::EraseValue:
+            for (auto value = range.first; value != range.second; ++value)
+            {
+                if (value->second == operation.value)
+                {
+                    map.erase(value);
+                    seen++;
+                    break;
+                }
+            }
+            break;
+        default:
+            for (auto value = range.first; value != range.second; ++value)
+                seen++;
+            break;
+        }
+    }
+    return seen;
+}
+
+// Fastest of `repetitions` replays on a fresh container, in ns per operation.
+template <typename TContainer, typename TCreate>
+double timeReplay(const std::vector<TraceOperation>& trace, unsigned repetitions, TCreate create)
+{
+    double best = 0;
+    for (unsigned i = 0; i < repetitions; i++)
+    {
+        TContainer container = create();
+        auto start = std::chrono::steady_clock::now();
+        replaySink = replayOn(container, trace);
+        auto finish = std::chrono::steady_clock::now();
+
+        double nanoseconds = std::chrono::duration<double, std::nano>(finish - start).count();
+        if (i == 0 || nanoseconds < best)
+            best = nanoseconds;
+    }
+    return trace.empty() ? 0 : best / trace.size();
+}
+
+int runReplayBenchmark(const FuzzerOptions& options, const std::vector<TraceOperation>& trace)
+{
+    DefaultComparator<uint64_t> comparator;
+    double treeNanoseconds = timeReplay<RBTree<uint64_t, uint64_t>>(trace, options.repetitions, [&]() {
+        return RBTree<uint64_t, uint64_t>(&comparator);
+    });
+    double mapNanoseconds = timeReplay<std::multimap<uint64_t, uint64_t>>(trace, options.repetitions, []() {
+        return std::multimap<uint64_t, uint64_t>();
+    });
+
+    std::ofstream file;
+    if (options.output != "-")
+        file.open(options.output);
+    std::ostream& out = options.output == "-" ? std::cout : file;
+
+    out << "{\n";
+    out << "  \"benchmark\": \"rbtree_replay\",\n";
+    out << "  \"format_version\": 1,\n";
+    out << "  \"configuration\": {\"trace\": \"" << options.replay << "\""
+        << ", \"operations\": " << trace.size()
+        << ", \"repetitions\": " << options.repetitions << "},\n";
+    out << "  \"results\": [\n";
+    out << "    {\"container\": \"RBTree\", \"ns_per_op\": " << treeNanoseconds << "},\n";
+    out << "    {\"container\": \"std::multimap\", \"ns_per_op\": " << mapNanoseconds << "}\n";
+    out << "  ]\n}\n";
+
+    if (!out)
+    {
+        std::cerr << "Can't write " << options.output << '\n';
+        return 1;
+    }
+    return 0;
+}
+
+int runReplay(const FuzzerOptions& options)
+{
+    std::ifstream in(options.replay);
+    if (!in)
+    {
+        std::cerr << "Can't read " << options.replay << '\n';
+        return 1;
+    }
+
+    std::vector<TraceOperation> trace;
+    uint64_t badLine = 0;
+    if (!readTrace(in, trace, badLine))
+    {
+        std::cerr << options.replay << ':' << badLine << ": not an operation\n";
+        return 1;
+    }
+
+    if (options.benchmark)
+        return runReplayBenchmark(options, trace);
+
+    std::string mismatch;
+    size_t failed = replayChecked(trace, options.validateEvery, mismatch);
+    if (failed != trace.size())
+    {
+        std::cerr << "Operation " << failed << " (" << toString(trace[failed].type) << ' ' << trace[failed].key
+                  << "): " << mismatch << '\n';
+        return 1;
+    }
+    std::cerr << trace.size() << " operations passed\n";
+    return 0;
+}
+
+bool parseOptions(int argc, char** argv, FuzzerOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string value;
+        if (readOption(argv[i], "--seed", value))
+            options.seed = std::strtoull(value.c_str(), nullptr, 10);
+        else if (readOption(argv[i], "--iterations", value))
+            options.iterations = std::strtoull(value.c_str(), nullptr, 10);
+        else if (readOption(argv[i], "--operations", value))
+            options.operations = std::strtoull(value.c_str(), nullptr, 10);
+        else if (readOption(argv[i], "--validate-every", value))
+            options.validateEvery = std::strtoull(value.c_str(), nullptr, 10);
+        else if (readOption(argv[i], "--failure-output", value))
+            options.failureOutput = value;
+        else if (readOption(argv[i], "--replay", value))
+            options.replay = value;
+        else if (std::strcmp(argv[i], "--benchmark") == 0)
+            options.benchmark = true;
+        else if (readOption(argv[i], "--repetitions", value))
+            options.repetitions = std::max(1u, unsigned(std::strtoul(value.c_str(), nullptr, 10)));
+        else if (readOption(argv[i], "--output", value))
+            options.output = value;
+        else
+        {
+            std::cerr << "Unknown option " << argv[i] << '\n'
+                      << "Usage: " << argv[0]
+                      << " [--seed=N] [--iterations=N] [--operations=N] [--validate-every=N] [--failure-output=FILE]\n"
+                      << "       " << argv[0]
+                      << " --replay=FILE [--validate-every=N] [--benchmark] [--repetitions=N] [--output=FILE|-]\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    FuzzerOptions options;
+    if (!parseOptions(argc, argv, options))
+        return 1;
+
+    if (!options.replay.empty())
+        return runReplay(options);
+    return runFuzzer(options);
+}
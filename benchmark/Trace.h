@@ -0,0 +1,232 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Workload.h"
+
+// Operation traces over uint64 keys and values, generated from a seed or
+// read from a text file with one operation per line:
+//
+//   insert <key> <value>
+//   erase <key>
+//   erase_one <key>
+//   erase_value <key> <value>
+//   find <key>
+//   assign <key> <value>        replaces all values of key with value
+//   upsert <key> <value>        adds value to the first value of key,
+//                               inserting 0 first if key is absent
+//   update <key> <value>        the same, only if key is present
+//   lower_bound <key>           the first key not less than key, and the
+//                               key before it
+//   copy                        replaces the tree with a copy of itself
+//   move                        moves the tree out and back in
+//   clear                       clears the tree, keeping its nodes for reuse
+//
+// Empty lines and lines starting with '#' are skipped, so a trace captured in
+// production can be annotated and replayed as it is.
+
+enum class TraceOperationType
+{
+    Insert,
+    Erase,
+    EraseOne,
+    EraseValue,
+    Find,
+    Assign,
+    Upsert,
+    Update,
+    LowerBound,
+    Copy,
+    Move,
+    Clear
+};
+
+struct TraceOperation
+{
+    TraceOperationType type;
+    uint64_t key;
+    uint64_t value;
+};
+
+// Percentages of the generated operations; finds make up the rest.
+struct TraceMix
+{
+    unsigned insert = 40;
+    unsigned erase = 10;
+    unsigned eraseOne = 10;
+    unsigned eraseValue = 10;
+    unsigned assign = 0;
+    unsigned upsert = 0;
+    unsigned update = 0;
+    unsigned lowerBound = 0;
+    unsigned copy = 0;
+    unsigned move = 0;
+    unsigned clear = 0;
+};
+
+// Generated values are below traceValueRange, so erase_value often finds
+// the value it names.
+const uint64_t traceValueRange = 8;
+
+inline const char* toString(TraceOperationType type)
+{
+    switch (type)
+    {
+    case TraceOperationType::Insert:
+        return "insert";
+    case TraceOperationType::Erase:
+        return "erase";
+    case TraceOperationType::EraseOne:
+        return "erase_one";
+    case TraceOperationType::EraseValue:
+        return "erase_value";
+    case TraceOperationType::Assign:
+        return "assign";
+    case TraceOperationType::Upsert:
+        return "upsert";
+    case TraceOperationType::Update:
+        return "update";
+    case TraceOperationType::LowerBound:
+        return "lower_bound";
+    case TraceOperationType::Copy:
+        return "copy";
+    case TraceOperationType::Move:
+        return "move";
+    case TraceOperationType::Clear:
+        return "clear";
+    default:
+        return "find";
+    }
+}
+
+// Number of arguments after the operation name in a trace file.
+inline int argumentsOf(TraceOperationType type)
+{
+    switch (type)
+    {
+    case TraceOperationType::Insert:
+    case TraceOperationType::EraseValue:
+    case TraceOperationType::Assign:
+    case TraceOperationType::Upsert:
+    case TraceOperationType::Update:
+        return 2;
+    case TraceOperationType::Copy:
+    case TraceOperationType::Move:
+    case TraceOperationType::Clear:
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+// Keys are drawn from keySpace distinct keys with the given distribution; a
+// small key space gives many duplicates and erases that hit.
+inline std::vector<TraceOperation> makeTrace(
+        KeyDistribution distribution,
+        const TraceMix& mix,
+        uint64_t keySpace,
+        uint64_t operations,
+        uint64_t seed) {
+
+    SplitMix64 random(seed);
+    ZipfianGenerator zipfian(distribution == KeyDistribution::Zipfian ? keySpace : 1);
+    std::vector<TraceOperation> trace;
+    trace.reserve(operations);
+    for (uint64_t i = 0; i < operations; i++)
+    {
+        uint64_t key;
+        if (distribution == KeyDistribution::Sequential)
+            key = i % keySpace;
+        else if (distribution == KeyDistribution::Random)
+            key = scrambleKey(random.nextBelow(keySpace));
+        else
+            key = scrambleKey(zipfian.next(random));
+
+        uint64_t dice = random.nextBelow(100);
+        TraceOperation operation = {TraceOperationType::Find, key, random.nextBelow(traceValueRange)};
+        if (dice < mix.insert)
+            operation.type = TraceOperationType::Insert;
+        else if ((dice -= mix.insert) < mix.erase)
+            operation.type = TraceOperationType::Erase;
+        else if ((dice -= mix.erase) < mix.eraseOne)
+            operation.type = TraceOperationType::EraseOne;
+        else if ((dice -= mix.eraseOne) < mix.eraseValue)
+            operation.type = TraceOperationType::EraseValue;
+        else if ((dice -= mix.eraseValue) < mix.assign)
+            operation.type = TraceOperationType::Assign;
+        else if ((dice -= mix.assign) < mix.upsert)
+            operation.type = TraceOperationType::Upsert;
+        else if ((dice -= mix.upsert) < mix.update)
+            operation.type = TraceOperationType::Update;
+        else if ((dice -= mix.update) < mix.lowerBound)
+            operation.type = TraceOperationType::LowerBound;
+        else if ((dice -= mix.lowerBound) < mix.copy)
+            operation.type = TraceOperationType::Copy;
+        else if ((dice -= mix.copy) < mix.move)
+            operation.type = TraceOperationType::Move;
+        else if ((dice -= mix.move) < mix.clear)
+            operation.type = TraceOperationType::Clear;
+
+        if (argumentsOf(operation.type) == 0)
+            operation.key = 0;
+        if (argumentsOf(operation.type) < 2)
+            operation.value = 0;
+        trace.push_back(operation);
+    }
+    return trace;
+}
+
+inline void writeTrace(std::ostream& out, const std::vector<TraceOperation>& trace)
+{
+    for (const TraceOperation& operation : trace)
+    {
+        out << toString(operation.type);
+        if (argumentsOf(operation.type) >= 1)
+            out << ' ' << operation.key;
+        if (argumentsOf(operation.type) == 2)
+            out << ' ' << operation.value;
+        out << '\n';
+    }
+}
+
+// Returns false, with the number of the bad line, on the first line that
+// isn't an operation.
+inline bool readTrace(std::istream& in, std::vector<TraceOperation>& trace, uint64_t& badLine)
+{
+    std::string line;
+    for (badLine = 1; std::getline(in, line); badLine++)
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        char name[16] = {};
+        unsigned long long key = 0, value = 0;
+        int fields = std::sscanf(line.c_str(), "%15s %llu %llu", name, &key, &value);
+        std::string type = name;
+
+        const TraceOperationType types[] = {
+                TraceOperationType::Insert, TraceOperationType::Erase, TraceOperationType::EraseOne,
+                TraceOperationType::EraseValue, TraceOperationType::Find, TraceOperationType::Assign,
+                TraceOperationType::Upsert, TraceOperationType::Update, TraceOperationType::LowerBound,
+                TraceOperationType::Copy, TraceOperationType::Move, TraceOperationType::Clear};
+        bool known = false;
+        TraceOperation operation = {TraceOperationType::Find, key, value};
+        for (TraceOperationType candidate : types)
+        {
+            if (type == toString(candidate) && fields == 1 + argumentsOf(candidate))
+            {
+                operation.type = candidate;
+                known = true;
+            }
+        }
+        if (!known)
+            return false;
+        trace.push_back(operation);
+    }
+    return true;
+}
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Deterministic key streams for the benchmarks. Everything is derived from
+// a 64-bit seed with our own generators, so a seed gives the same keys with
+// every standard library.
+
+class SplitMix64
+{
+private:
+    uint64_t state;
+
+public:
+    explicit SplitMix64(uint64_t seed) : state(seed)
+    {
+    }
+
+    uint64_t next()
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t nextBelow(uint64_t bound)
+    {
+        return bound == 0 ? 0 : next() % bound;
+    }
+
+    double nextDouble()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+};
+
+// Bijective mix of a 64-bit value: distinct inputs give distinct keys.
+inline uint64_t scrambleKey(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDULL;
+    value ^= value >> 33;
+    value *= 0xC4CEB9FE1A85EC53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+// Zipfian ranks in [0, items), rank 0 being the most popular
+// (Gray et al., "Quickly generating billion-record synthetic databases").
+class ZipfianGenerator
+{
+private:
+    uint64_t items;
+    double theta;
+    double alpha;
+    double zetaN;
+    double eta;
+
+public:
+    explicit ZipfianGenerator(uint64_t items, double theta = 0.99) : items(items), theta(theta)
+    {
+        double zeta2 = zeta(2);
+        zetaN = zeta(items);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / items, 1.0 - theta)) / (1.0 - zeta2 / zetaN);
+    }
+
+    uint64_t next(SplitMix64& random) const
+    {
+        double u = random.nextDouble();
+        double uz = u * zetaN;
+        if (uz < 1.0)
+            return 0;
+        if (uz < 1.0 + std::pow(0.5, theta))
+            return items > 1 ? 1 : 0;
+
+        uint64_t rank = static_cast<uint64_t>(items * std::pow(eta * u - eta + 1.0, alpha));
+        return rank < items ? rank : items - 1;
+    }
+
+private:
+    double zeta(uint64_t count) const
+    {
+        double sum = 0;
+        for (uint64_t i = 1; i <= count; i++)
+        {
+            sum += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        return sum;
+    }
+};
+
+enum class KeyDistribution
+{
+    Sequential,
+    Random,
+    Zipfian
+};
+
+enum class KeyMultiplicity
+{
+    Unique,
+    Duplicates
+};
+
+inline const char* toString(KeyDistribution distribution)
+{
+    switch (distribution)
+    {
+    case KeyDistribution::Sequential:
+        return "sequential";
+    case KeyDistribution::Random:
+        return "random";
+    default:
+        return "zipfian";
+    }
+}
+
+inline const char* toString(KeyMultiplicity multiplicity)
+{
+    return multiplicity == KeyMultiplicity::Unique ? "unique" : "duplicates";
+}
+
+// Duplicate-heavy workloads draw their keys from size / duplicateFactor
+// distinct values.
+const uint64_t duplicateFactor = 16;
+
+inline uint64_t keySpaceSize(uint64_t size, KeyMultiplicity multiplicity)
+{
+    if (multiplicity == KeyMultiplicity::Unique)
+        return size;
+    return std::max<uint64_t>(1, size / duplicateFactor);
+}
+
+// Produces the keys of one workload. Sequential keys ascend, random keys are
+// uniform over the key space and zipfian keys are skewed towards a few hot
+// keys. Zipfian draws repeat keys even in a unique key space.
+class KeyGenerator
+{
+private:
+    KeyDistribution distribution;
+    uint64_t keySpace;
+    uint64_t drawn = 0;
+    SplitMix64 random;
+    ZipfianGenerator zipfian;
+    bool unique;
+
+public:
+    KeyGenerator(KeyDistribution distribution, KeyMultiplicity multiplicity, uint64_t size, uint64_t seed)
+        : distribution(distribution),
+          keySpace(keySpaceSize(size, multiplicity)),
+          random(seed),
+          zipfian(distribution == KeyDistribution::Zipfian ? keySpace : 1),
+          unique(multiplicity == KeyMultiplicity::Unique)
+    {
+    }
+
+    uint64_t next()
+    {
+        uint64_t index = drawn++;
+        switch (distribution)
+        {
+        case KeyDistribution::Sequential:
+            return unique ? index : index / duplicateFactor;
+        case KeyDistribution::Random:
+            return scrambleKey(unique ? index : random.nextBelow(keySpace));
+        default:
+            return scrambleKey(zipfian.next(random));
+        }
+    }
+};
+
+// Picks positions in a key vector with the workload's access pattern.
+class IndexPicker
+{
+private:
+    KeyDistribution distribution;
+    uint64_t picked = 0;
+    SplitMix64 random;
+    ZipfianGenerator zipfian;
+
+public:
+    IndexPicker(KeyDistribution distribution, uint64_t size, uint64_t seed)
+        : distribution(distribution),
+          random(seed),
+          zipfian(distribution == KeyDistribution::Zipfian ? std::max<uint64_t>(size, 1) : 1)
+    {
+    }
+
+    uint64_t next(uint64_t count)
+    {
+        switch (distribution)
+        {
+        case KeyDistribution::Sequential:
+            return picked++ % count;
+        case KeyDistribution::Random:
+            return random.nextBelow(count);
+        default:
+            return zipfian.next(random) % count;
+        }
+    }
+};
+
+inline std::vector<uint64_t> makeKeys(
+        KeyDistribution distribution,
+        KeyMultiplicity multiplicity,
+        uint64_t size,
+        uint64_t seed) {
+
+    KeyGenerator generator(distribution, multiplicity, size, seed);
+    std::vector<uint64_t> keys(size);
+    for (uint64_t& key : keys)
+    {
+        key = generator.next();
+    }
+    return keys;
+}
+
+// Distinct keys in the order they were first inserted.
+inline std::vector<uint64_t> distinctKeysInInsertOrder(const std::vector<uint64_t>& keys)
+{
+    std::vector<uint64_t> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    std::vector<bool> seen(sorted.size(), false);
+    std::vector<uint64_t> distinct;
+    distinct.reserve(sorted.size());
+    for (uint64_t key : keys)
+    {
+        size_t position = std::lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+        if (!seen[position])
+        {
+            seen[position] = true;
+            distinct.push_back(key);
+        }
+    }
+    return distinct;
+}
+
+// Keys that don't occur in `keys`, for lookups and erases that miss.
+inline std::vector<uint64_t> makeMissingKeys(const std::vector<uint64_t>& keys, uint64_t count, uint64_t seed)
+{
+    std::vector<uint64_t> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+
+    SplitMix64 random(seed);
+    std::vector<uint64_t> missing;
+    missing.reserve(count);
+    while (missing.size() < count)
+    {
+        uint64_t key = random.next();
+        if (!std::binary_search(sorted.begin(), sorted.end(), key))
+            missing.push_back(key);
+    }
+    return missing;
+}
@@ -0,0 +1,394 @@
+// Throughput and tail latency of many writer threads: WriteCombiningRBTree
+// against an RBTree behind one mutex.
+//
+// Every writer adds its own unique keys and pops one of them for every
+// three adds; reader threads look up keys meanwhile. Throughput counts the
+// time until all writes are applied (for WriteCombiningRBTree, until the
+// final flush returns). Call latency is the time of each add/pop call as seen
+// by its writer; visible latency runs from the start of that call until
+// readers can find the change. A locked tree's changes are visible when the
+// call returns, so both latencies are the same for it. WriteCombiningRBTree
+// returns once the operation is buffered and applies it later, so for it the
+// visible latency is the one to compare.
+//
+//   rbtree_concurrency_benchmark [--threads=N] [--readers=N] [--operations=N]
+//                                [--seed=N] [--output=FILE|-]
+//
+// Writer counts are 1, 2, 4, ... up to --threads; --operations is per writer.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RedBlackTree.h"
+#include "WriteCombiningRBTree.h"
+#include "comparators/DefaultComparator.h"
+#include "Options.h"
+#include "Workload.h"
+
+struct ConcurrencyOptions
+{
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned readers = 1;
+    uint64_t operations = 1000000;
+    uint64_t seed = 42;
+    std::string output = "rbtree_concurrency_benchmark.json";
+};
+
+struct ConcurrencyResult
+{
+    std::string container;
+    unsigned writers = 0;
+    unsigned readers = 0;
+    uint64_t operations = 0;
+    double operationsPerSecond = 0;
+    double readsPerSecond = 0;
+    uint64_t latencyP50 = 0;
+    uint64_t latencyP99 = 0;
+    uint64_t latencyP999 = 0;
+    uint64_t latencyMax = 0;
+    uint64_t visibleLatencyP50 = 0;
+    uint64_t visibleLatencyP99 = 0;
+    uint64_t visibleLatencyP999 = 0;
+    uint64_t visibleLatencyMax = 0;
+};
+
+class LockedRBTreeContainer
+{
+private:
+    DefaultComparator<uint64_t> comparator;
+    RBTree<uint64_t, uint64_t> tree;
+    std::mutex mutex;
+
+public:
+    static const char* name()
+    {
+        return "LockedRBTree";
+    }
+
+    explicit LockedRBTreeContainer(uint64_t /*operations*/) : tree(&comparator)
+    {
+    }
+
+    void add(uint64_t key, uint64_t value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tree.add(key, value);
+    }
+
+    void pop(uint64_t key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tree.pop(key);
+    }
+
+    size_t find(uint64_t key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return tree.find(key).size();
+    }
+
+    void finish()
+    {
+    }
+
+    std::vector<uint64_t> visibleLatencies(const std::vector<uint64_t>& callLatencies)
+    {
+        return callLatencies;
+    }
+};
+
+class WriteCombiningRBTreeContainer
+{
+private:
+    // Filled by the applier thread only; the hook has no context pointer.
+    static std::vector<uint64_t> appliedLatencies;
+
+    DefaultComparator<uint64_t> comparator;
+    WriteCombiningRBTree<uint64_t, uint64_t> tree;
+
+    static void recordVisibleLatency(std::chrono::nanoseconds latency)
+    {
+        appliedLatencies.push_back(latency.count());
+    }
+
+    static WriteCombiningOptions treeOptions(uint64_t operations)
+    {
+        appliedLatencies.clear();
+        appliedLatencies.reserve(operations);
+        WriteCombiningOptions options;
+        options.visibilityLatencyHook = recordVisibleLatency;
+        return options;
+    }
+
+public:
+    static const char* name()
+    {
+        return "WriteCombiningRBTree";
+    }
+
+    explicit WriteCombiningRBTreeContainer(uint64_t operations) : tree(&comparator, treeOptions(operations))
+    {
+    }
+
+    void add(uint64_t key, uint64_t value)
+    {
+        tree.add(key, value);
+    }
+
+    void pop(uint64_t key)
+    {
+        tree.pop(key);
+    }
+
+    size_t find(uint64_t key)
+    {
+        return tree.find(key).size();
+    }
+
+    void finish()
+    {
+        tree.flush();
+    }
+
+    // Complete once every writer's finish() has returned.
+    std::vector<uint64_t> visibleLatencies(const std::vector<uint64_t>& /*callLatencies*/)
+    {
+        return std::move(appliedLatencies);
+    }
+};
+
+std::vector<uint64_t> WriteCombiningRBTreeContainer::appliedLatencies;
+
+volatile uint64_t benchmarkSink;
+
+// Keys of one writer: disjoint from the keys of every other writer.
+uint64_t writerKey(unsigned writer, uint64_t index)
+{
+    return scrambleKey((uint64_t(writer) << 40) | index);
+}
+
+uint64_t percentile(const std::vector<uint64_t>& sortedLatencies, double fraction)
+{
+    if (sortedLatencies.empty())
+        return 0;
+    size_t index = static_cast<size_t>(fraction * (sortedLatencies.size() - 1));
+    return sortedLatencies[index];
+}
+
+template <typename TContainer>
+ConcurrencyResult runConcurrencyBenchmark(const ConcurrencyOptions& options, unsigned writers)
+{
+    TContainer container(uint64_t(writers) * options.operations);
+    std::vector<std::vector<uint64_t>> latencies(writers);
+    std::atomic<unsigned> readyThreads{0};
+    std::atomic<bool> started{false};
+    std::atomic<bool> writing{true};
+    std::atomic<uint64_t> reads{0};
+
+    auto waitForStart = [&]() {
+        readyThreads++;
+        while (!started.load(std::memory_order_acquire))
+            std::this_thread::yield();
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned writer = 0; writer < writers; writer++)
+    {
+        threads.emplace_back([&, writer]() {
+            std::vector<uint64_t>& writerLatencies = latencies[writer];
+            writerLatencies.reserve(options.operations);
+            SplitMix64 random(options.seed + writer);
+            uint64_t added = 0;
+            uint64_t popped = 0;
+            waitForStart();
+
+            for (uint64_t i = 0; i < options.operations; i++)
+            {
+                bool pop = random.nextBelow(4) == 0 && popped < added;
+                auto start = std::chrono::steady_clock::now();
+                if (pop)
+                    container.pop(writerKey(writer, popped++));
+                else
+                    container.add(writerKey(writer, added++), i);
+                auto finish = std::chrono::steady_clock::now();
+                writerLatencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count());
+            }
+            container.finish();
+        });
+    }
+    for (unsigned reader = 0; reader < options.readers; reader++)
+    {
+        threads.emplace_back([&, reader]() {
+            SplitMix64 random(options.seed + 1000 + reader);
+            uint64_t readerReads = 0;
+            uint64_t values = 0;
+            waitForStart();
+
+            while (writing.load(std::memory_order_relaxed))
+            {
+                values += container.find(writerKey(unsigned(random.nextBelow(writers)), random.nextBelow(options.operations)));
+                readerReads++;
+            }
+            reads += readerReads;
+            benchmarkSink = values;
+        });
+    }
+
+    while (readyThreads.load() != writers + options.readers)
+        std::this_thread::yield();
+    auto start = std::chrono::steady_clock::now();
+    started.store(true, std::memory_order_release);
+
+    for (unsigned writer = 0; writer < writers; writer++)
+    {
+        threads[writer].join();
+    }
+    auto finish = std::chrono::steady_clock::now();
+    writing = false;
+    for (size_t i = writers; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+
+    std::vector<uint64_t> allLatencies;
+    allLatencies.reserve(uint64_t(writers) * options.operations);
+    for (const std::vector<uint64_t>& writerLatencies : latencies)
+    {
+        allLatencies.insert(allLatencies.end(), writerLatencies.begin(), writerLatencies.end());
+    }
+    std::sort(allLatencies.begin(), allLatencies.end());
+    std::vector<uint64_t> visibleLatencies = container.visibleLatencies(allLatencies);
+    std::sort(visibleLatencies.begin(), visibleLatencies.end());
+
+    double seconds = std::chrono::duration<double>(finish - start).count();
+    ConcurrencyResult result;
+    result.container = TContainer::name();
+    result.writers = writers;
+    result.readers = options.readers;
+    result.operations = uint64_t(writers) * options.operations;
+    result.operationsPerSecond = result.operations / seconds;
+    result.readsPerSecond = reads / seconds;
+    result.latencyP50 = percentile(allLatencies, 0.5);
+    result.latencyP99 = percentile(allLatencies, 0.99);
+    result.latencyP999 = percentile(allLatencies, 0.999);
+    result.latencyMax = allLatencies.empty() ? 0 : allLatencies.back();
+    result.visibleLatencyP50 = percentile(visibleLatencies, 0.5);
+    result.visibleLatencyP99 = percentile(visibleLatencies, 0.99);
+    result.visibleLatencyP999 = percentile(visibleLatencies, 0.999);
+    result.visibleLatencyMax = visibleLatencies.empty() ? 0 : visibleLatencies.back();
+
+    std::fprintf(stderr, "%-22s %2u writers %12.0f ops/s %12.0f reads/s"
+            "  call p50 %6llu p99 %8llu p999 %8llu"
+            "  visible p50 %8llu p99 %8llu p999 %8llu ns\n",
+            result.container.c_str(), writers, result.operationsPerSecond, result.readsPerSecond,
+            static_cast<unsigned long long>(result.latencyP50),
+            static_cast<unsigned long long>(result.latencyP99),
+            static_cast<unsigned long long>(result.latencyP999),
+            static_cast<unsigned long long>(result.visibleLatencyP50),
+            static_cast<unsigned long long>(result.visibleLatencyP99),
+            static_cast<unsigned long long>(result.visibleLatencyP999));
+    return result;
+}
+
+void writeResults(std::ostream& out, const ConcurrencyOptions& options, const std::vector<ConcurrencyResult>& results)
+{
+    out << "{\n";
+    out << "  \"benchmark\": \"rbtree_concurrency\",\n";
+    out << "  \"format_version\": 2,\n";
+    out << "  \"configuration\": {\"threads\": " << options.threads
+        << ", \"readers\": " << options.readers
+        << ", \"operations\": " << options.operations
+        << ", \"seed\": " << options.seed << "},\n";
+    out << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const ConcurrencyResult& result = results[i];
+        out << (i ? ",\n" : "\n");
+        out << "    {\"name\": \"" << result.container << "/" << result.writers << "\""
+            << ", \"container\": \"" << result.container << "\""
+            << ", \"writers\": " << result.writers
+            << ", \"readers\": " << result.readers
+            << ", \"operations\": " << result.operations
+            << ", \"ops_per_second\": " << result.operationsPerSecond
+            << ", \"reads_per_second\": " << result.readsPerSecond
+            << ", \"latency_ns\": {\"p50\": " << result.latencyP50
+            << ", \"p99\": " << result.latencyP99
+            << ", \"p999\": " << result.latencyP999
+            << ", \"max\": " << result.latencyMax << "}"
+            << ", \"visible_latency_ns\": {\"p50\": " << result.visibleLatencyP50
+            << ", \"p99\": " << result.visibleLatencyP99
+            << ", \"p999\": " << result.visibleLatencyP999
+            << ", \"max\": " << result.visibleLatencyMax << "}}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+bool parseOptions(int argc, char** argv, ConcurrencyOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string value;
+        if (readOption(argv[i], "--threads", value))
+            options.threads = std::max(1u, unsigned(std::strtoul(value.c_str(), nullptr, 10)));
+        else if (readOption(argv[i], "--readers", value))
+            options.readers = unsigned(std::strtoul(value.c_str(), nullptr, 10));
+        else if (readOption(argv[i], "--operations", value))
+            options.operations = std::strtoull(value.c_str(), nullptr, 10);
+        else if (readOption(argv[i], "--seed", value))
+            options.seed = std::strtoull(value.c_str(), nullptr, 10);
+        else if (readOption(argv[i], "--output", value))
+            options.output = value;
+        else
+        {
+            std::cerr << "Unknown option " << argv[i] << '\n'
+                      << "Usage: " << argv[0]
+                      << " [--threads=N] [--readers=N] [--operations=N] [--seed=N] [--output=FILE|-]\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    ConcurrencyOptions options;
+    if (!parseOptions(argc, argv, options))
+        return 1;
+
+    std::vector<ConcurrencyResult> results;
+    for (unsigned writers = 1; ; writers *= 2)
+    {
+        writers = std::min(writers, options.threads);
+        results.push_back(runConcurrencyBenchmark<LockedRBTreeContainer>(options, writers));
+        results.push_back(runConcurrencyBenchmark<WriteCombiningRBTreeContainer>(options, writers));
+        if (writers == options.threads)
+            break;
+    }
+
+    if (options.output == "-")
+    {
+        writeResults(std::cout, options, results);
+    }
+    else
+    {
+        std::ofstream out(options.output);
+        writeResults(out, options, results);
+        if (!out)
+        {
+            std::cerr << "Can't write " << options.output << '\n';
+            return 1;
+        }
+    }
+    return 0;
+}
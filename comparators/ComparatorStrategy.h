@@ -0,0 +1,12 @@
+#pragma once
+
+// Ordering used by RBTree. compare must return -1 if left < right,
+// 0 if they are equal and 1 if left > right: the tree compares results
+// of different compare calls with each other.
+template <typename T>
+class ComparatorStrategy
+{
+public:
+    virtual int compare(const T& left, const T& right) const = 0;
+    virtual ~ComparatorStrategy() = default;
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "ComparatorStrategy.h"
+
+// Comparator for any type with operator<.
+template <typename T>
+class DefaultComparator : public ComparatorStrategy<T>
+{
+public:
+    int compare(const T& left, const T& right) const override
+    {
+        if (left < right)
+            return -1;
+        if (right < left)
+            return 1;
+        return 0;
+    }
+};
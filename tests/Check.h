@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// Checks for the test executables. A failed check prints the condition and
+// where it is, and ends the test with a non-zero exit status.
+#define CHECK(condition) checkCondition((condition), #condition, __FILE__, __LINE__)
+
+inline void checkCondition(bool passed, const char* condition, const char* file, int line)
+{
+    if (!passed)
+    {
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, condition);
+        std::exit(1);
+    }
+}
@@ -0,0 +1,287 @@
+// Behaviour checks for ExpiringRBTree, against a std::map model. Run by ctest.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <map>
+
+#include "ExpiringRBTree.h"
+#include "benchmark/Workload.h"
+#include "Check.h"
+
+// Clock the tests move by hand.
+struct TestClock
+{
+    typedef std::chrono::seconds duration;
+    typedef duration::rep rep;
+    typedef duration::period period;
+    typedef std::chrono::time_point<TestClock> time_point;
+    static const bool is_steady = true;
+
+    static time_point current;
+
+    static time_point now()
+    {
+        return current;
+    }
+};
+
+TestClock::time_point TestClock::current;
+
+typedef ExpiringRBTree<int, int, TestClock> Cache;
+
+TestClock::time_point at(int seconds)
+{
+    return TestClock::time_point(std::chrono::seconds(seconds));
+}
+
+void checkExpiryInDeadlineOrder()
+{
+    DefaultComparator<int> comparator;
+    Cache cache(&comparator);
+    cache.add(1, 10, at(30));
+    cache.add(2, 20, at(10));
+    cache.add(3, 30, at(20));
+    cache.add(4, 40); // no time to live set: never expires
+
+    CHECK(cache.expireUntil(at(9)) == 0);
+    CHECK(cache.expireUntil(at(10)) == 1);
+    CHECK(cache.find(2).empty());
+    CHECK(cache.find(3).size() == 1);
+
+    // A new deadline replaces the old one.
+    cache.add(3, 31, at(40));
+    CHECK(cache.expireUntil(at(30)) == 1);
+    CHECK(cache.find(1).empty());
+    CHECK(cache.find(3).front() == 31);
+    CHECK(cache.expireUntil(at(1000)) == 1);
+    CHECK(cache.size() == 1);
+    CHECK(cache.find(4).front() == 40);
+}
+
+void checkTimeToLiveUsesTheClock()
+{
+    DefaultComparator<int> comparator;
+    Cache cache(&comparator);
+    TestClock::current = at(100);
+    cache.setTimeToLive(std::chrono::seconds(5));
+    cache.add(1, 10);
+    TestClock::current = at(102);
+    cache.add(2, 20);
+
+    CHECK(cache.expireUntil(at(104)) == 0);
+    CHECK(cache.expireUntil(at(105)) == 1);
+    CHECK(cache.find(1).empty());
+    CHECK(cache.expireUntil(at(107)) == 1);
+    CHECK(cache.size() == 0);
+}
+
+// Keys that share a deadline are indexed separately, so each one can be
+// replaced and popped on its own.
+void checkSharedDeadlines()
+{
+    DefaultComparator<int> comparator;
+    Cache cache(&comparator);
+    for (int key = 0; key < 1000; key++)
+    {
+        cache.add(key, key, at(50));
+    }
+    for (int key = 999; key >= 0; key -= 2)
+    {
+        cache.add(key, -key, at(60));
+    }
+    for (int key = 0; key < 1000; key += 4)
+    {
+        CHECK(cache.pop(key) == 1);
+    }
+
+    CHECK(cache.expireUntil(at(50)) == 250);
+    CHECK(cache.size() == 500);
+    CHECK(cache.find(1).front() == -1);
+    CHECK(cache.expireUntil(at(60)) == 500);
+    CHECK(cache.size() == 0);
+}
+
+void checkLeastRecentlyUsedEviction()
+{
+    DefaultComparator<int> comparator;
+    Cache cache(&comparator);
+    cache.setCapacity(3, EvictionPolicy::LeastRecentlyUsed);
+    cache.add(1, 10);
+    cache.add(2, 20);
+    cache.add(3, 30);
+    CHECK(cache.find(1).size() == 1);
+
+    cache.add(4, 40);
+    CHECK(cache.size() == 3);
+    CHECK(cache.find(2).empty());
+
+    cache.add(3, 31); // replacing is a use too
+    cache.add(5, 50);
+    CHECK(cache.find(1).empty());
+    CHECK(cache.find(3).front() == 31);
+    CHECK(cache.find(4).size() == 1);
+    CHECK(cache.find(5).size() == 1);
+}
+
+void checkMinimalKeyEviction()
+{
+    DefaultComparator<int> comparator;
+    Cache cache(&comparator);
+    cache.setCapacity(2, EvictionPolicy::MinimalKey);
+    cache.add(5, 50);
+    cache.add(7, 70);
+    CHECK(cache.find(5).size() == 1);
+
+    cache.add(6, 60);
+    CHECK(cache.size() == 2);
+    CHECK(cache.find(5).empty());
+    cache.add(1, 10);
+    CHECK(cache.find(1).empty());
+    CHECK(cache.find(6).size() == 1);
+}
+
+// Lowering the capacity evicts at once, and switching to LeastRecentlyUsed
+// starts from the order of the last adds, as finds didn't count before.
+void checkCapacitySwitching()
+{
+    DefaultComparator<int> comparator;
+    Cache cache(&comparator);
+    for (int key = 1; key <= 6; key++)
+    {
+        cache.add(key, key * 10);
+    }
+    cache.add(1, 11);
+    CHECK(cache.find(2).size() == 1);
+
+    cache.setCapacity(4, EvictionPolicy::MinimalKey);
+    CHECK(cache.size() == 4);
+    CHECK(cache.find(1).empty());
+    CHECK(cache.find(2).empty());
+
+    cache.setCapacity(2, EvictionPolicy::LeastRecentlyUsed);
+    CHECK(cache.size() == 2);
+    CHECK(cache.find(5).size() == 1);
+    CHECK(cache.find(6).size() == 1);
+
+    cache.setCapacity(0, EvictionPolicy::LeastRecentlyUsed);
+    for (int key = 10; key < 20; key++)
+    {
+        cache.add(key, key);
+    }
+    CHECK(cache.size() == 12);
+}
+
+struct ModelEntry
+{
+    int data;
+    TestClock::time_point deadline;
+    uint64_t lastUse;
+};
+
+// Random adds, pops, finds, expiry and capacity changes, checked against a
+// std::map that evicts by scanning.
+void checkAgainstModel(uint64_t seed)
+{
+    DefaultComparator<int> comparator;
+    Cache cache(&comparator);
+    std::map<int, ModelEntry> model;
+    uint64_t uses = 0;
+    size_t capacity = 0;
+    EvictionPolicy policy = EvictionPolicy::LeastRecentlyUsed;
+    int now = 0;
+    SplitMix64 random(seed);
+
+    auto evictModel = [&]() {
+        while (capacity != 0 && model.size() > capacity)
+        {
+            auto victim = model.begin();
+            if (policy == EvictionPolicy::LeastRecentlyUsed)
+            {
+                for (auto entry = model.begin(); entry != model.end(); ++entry)
+                {
+                    if (entry->second.lastUse < victim->second.lastUse)
+                        victim = entry;
+                }
+            }
+            model.erase(victim);
+        }
+    };
+
+    for (int i = 0; i < 20000; i++)
+    {
+        int key = int(random.nextBelow(300));
+        uint64_t operation = random.nextBelow(20);
+        if (operation < 8)
+        {
+            TestClock::time_point deadline = random.nextBelow(4) == 0 ? TestClock::time_point::max() : at(now + int(random.nextBelow(20)));
+            CHECK(cache.add(key, i, deadline) == (model.count(key) == 0));
+            model[key] = ModelEntry{i, deadline, ++uses};
+            evictModel();
+        }
+        else if (operation < 10)
+        {
+            CHECK(cache.pop(key) == model.erase(key));
+        }
+        else if (operation < 17)
+        {
+            std::list<int> values = cache.find(key);
+            auto entry = model.find(key);
+            CHECK(values.size() == (entry == model.end() ? 0 : 1));
+            if (entry != model.end())
+            {
+                CHECK(values.front() == entry->second.data);
+                if (capacity != 0 && policy == EvictionPolicy::LeastRecentlyUsed)
+                    entry->second.lastUse = ++uses;
+            }
+        }
+        else if (operation < 19)
+        {
+            now += int(random.nextBelow(4));
+            size_t expired = 0;
+            for (auto entry = model.begin(); entry != model.end();)
+            {
+                if (!(at(now) < entry->second.deadline))
+                {
+                    entry = model.erase(entry);
+                    expired++;
+                }
+                else
+                {
+                    ++entry;
+                }
+            }
+            CHECK(cache.expireUntil(at(now)) == expired);
+        }
+        else
+        {
+            capacity = random.nextBelow(3) == 0 ? 0 : size_t(random.nextBelow(100) + 1);
+            policy = random.nextBelow(2) ? EvictionPolicy::LeastRecentlyUsed : EvictionPolicy::MinimalKey;
+            cache.setCapacity(capacity, policy);
+            evictModel();
+        }
+        CHECK(cache.size() == model.size());
+    }
+
+    for (const auto& entry : model)
+    {
+        CHECK(cache.find(entry.first).size() == 1);
+    }
+}
+
+int main()
+{
+    checkExpiryInDeadlineOrder();
+    checkTimeToLiveUsesTheClock();
+    checkSharedDeadlines();
+    checkLeastRecentlyUsedEviction();
+    checkMinimalKeyEviction();
+    checkCapacitySwitching();
+    for (uint64_t seed = 1; seed <= 5; seed++)
+    {
+        checkAgainstModel(seed);
+    }
+    std::printf("ExpiringRBTree tests passed\n");
+    return 0;
+}
@@ -0,0 +1,199 @@
+// Behaviour checks for WriteCombiningRBTree. Run by ctest.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "WriteCombiningRBTree.h"
+#include "comparators/DefaultComparator.h"
+#include "benchmark/Workload.h"
+#include "Check.h"
+
+typedef WriteCombiningRBTree<uint64_t, uint64_t> WriteCombiningTree;
+
+// The applier calls the visibility latency hook after publishing a batch,
+// outside the tree lock, so the hook can stop it there and look at what
+// readers see.
+namespace applierGate
+{
+    WriteCombiningTree* tree = nullptr;
+    std::mutex mutex;
+    std::condition_variable released;
+    bool closed = false;
+    bool waiting = false;
+    std::atomic<bool> orderBroken{false};
+
+    void onPublished(std::chrono::nanoseconds)
+    {
+        tree->read([](const RBTree<uint64_t, uint64_t>& contents, uint64_t) {
+            if (contents.count(1) != 0 && contents.count(100) == 0)
+            {
+                orderBroken = true;
+            }
+        });
+
+        std::unique_lock<std::mutex> lock(mutex);
+        waiting = true;
+        released.notify_all();
+        released.wait(lock, []() { return !closed; });
+        waiting = false;
+    }
+}
+
+// A batch is a prefix of every buffer, so a reader never sees an operation
+// without the ones its thread pushed before, even when the applier has more
+// operations than fit into one batch.
+void checkOneThreadsOrderSurvivesSplitBatches()
+{
+    DefaultComparator<uint64_t> comparator;
+    WriteCombiningOptions options;
+    options.maxBatch = 1;
+    options.flushInterval = std::chrono::microseconds(1000000);
+    options.visibilityLatencyHook = applierGate::onPublished;
+    WriteCombiningTree tree(&comparator, options);
+    applierGate::tree = &tree;
+
+    // Hold the applier after its first batch, so both later adds are in the
+    // buffer when it drains again.
+    {
+        std::lock_guard<std::mutex> lock(applierGate::mutex);
+        applierGate::closed = true;
+    }
+    tree.add(50, 0);
+    {
+        std::unique_lock<std::mutex> lock(applierGate::mutex);
+        applierGate::released.wait(lock, []() { return applierGate::waiting; });
+    }
+    tree.add(100, 0);
+    tree.add(1, 0);
+    {
+        std::lock_guard<std::mutex> lock(applierGate::mutex);
+        applierGate::closed = false;
+    }
+    applierGate::released.notify_all();
+    tree.flush();
+
+    CHECK(!applierGate::orderBroken);
+    CHECK(tree.find(1).size() == 1);
+    CHECK(tree.find(100).size() == 1);
+    CHECK(tree.version() == 3);
+}
+
+// flush() returns once the caller's operations are visible, however long
+// the flush interval is.
+void checkFlushMakesOwnOperationsVisible()
+{
+    DefaultComparator<uint64_t> comparator;
+    WriteCombiningOptions options;
+    options.flushInterval = std::chrono::microseconds(60000000);
+    WriteCombiningTree tree(&comparator, options);
+
+    for (uint64_t key = 0; key < 100; key++)
+    {
+        tree.add(key, key);
+    }
+    tree.pop(7);
+    tree.add(7, 70);
+    tree.add(7, 71);
+    tree.flush();
+
+    tree.read([](const RBTree<uint64_t, uint64_t>& contents, uint64_t version) {
+        CHECK(version >= 1);
+        CHECK(contents.keyCount() == 100);
+        CHECK(contents.find(7) == std::list<uint64_t>({70, 71}));
+    });
+    tree.pop(7);
+    tree.flush();
+    CHECK(tree.find(7).empty());
+}
+
+// Writers with their own keys, each add values and pop keys again, in small
+// batches; the final tree must match a model of every
+// writer's operations. Half the writers are short-lived threads, so their
+// buffers are retired while the others keep pushing.
+void checkManyWritersAgainstModel(uint64_t seed)
+{
+    const unsigned writers = 8;
+    const uint64_t operations = 20000;
+
+    DefaultComparator<uint64_t> comparator;
+    WriteCombiningOptions options;
+    options.bufferCapacity = 64;
+    options.maxBatch = 100;
+    options.flushInterval = std::chrono::microseconds(200);
+    WriteCombiningTree tree(&comparator, options);
+
+    std::vector<std::map<uint64_t, std::list<uint64_t>>> models(writers);
+    auto write = [&](unsigned writer, uint64_t first, uint64_t last) {
+        SplitMix64 random(seed * 100 + writer * 10 + first);
+        std::map<uint64_t, std::list<uint64_t>>& model = models[writer];
+        for (uint64_t i = first; i < last; i++)
+        {
+            uint64_t key = (uint64_t(writer) << 32) | random.nextBelow(500);
+            if (random.nextBelow(3) == 0 && model.count(key) != 0)
+            {
+                tree.pop(key);
+                model.erase(key);
+            }
+            else
+            {
+                tree.add(key, i);
+                model[key].push_back(i);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned writer = 0; writer < writers; writer++)
+    {
+        threads.emplace_back([&, writer]() {
+            if (writer % 2 == 0)
+            {
+                write(writer, 0, operations);
+                return;
+            }
+            for (uint64_t first = 0; first < operations; first += 1000)
+            {
+                std::thread shortLived(write, writer, first, first + 1000);
+                shortLived.join();
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    tree.flush();
+
+    tree.read([&](const RBTree<uint64_t, uint64_t>& contents, uint64_t) {
+        CHECK(contents.validate());
+        size_t keys = 0;
+        for (const std::map<uint64_t, std::list<uint64_t>>& model : models)
+        {
+            keys += model.size();
+            for (const auto& entry : model)
+            {
+                CHECK(contents.find(entry.first) == entry.second);
+            }
+        }
+        CHECK(contents.keyCount() == keys);
+    });
+}
+
+int main()
+{
+    checkOneThreadsOrderSurvivesSplitBatches();
+    checkFlushMakesOwnOperationsVisible();
+    for (uint64_t seed = 1; seed <= 3; seed++)
+    {
+        checkManyWritersAgainstModel(seed);
+    }
+    std::printf("WriteCombiningRBTree tests passed\n");
+    return 0;
+}